@@ -0,0 +1,647 @@
+#include "audio_features.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define MEL_LOG_FLOOR 1e-10f
+// 10 / ln(10): natural log to decibels of power
+#define MEL_DB_PER_NEPER 4.3429448f
+
+// The n_fft-point real FFT runs as a half-size complex FFT in split form
+// (separate real and imaginary arrays), so every butterfly stage reads its
+// data and twiddles contiguously and vectorizes four lanes at a time.
+struct MelTables {
+    int sample_rate;
+    MelConfig config;
+    int half;                   // n_fft / 2, points of the complex FFT
+    int bins;                   // n_fft / 2 + 1 power bins
+    float *window;              // periodic Hann
+    uint32_t *bitrev;
+    float *tw_re, *tw_im;       // stage with half size m: entries m - 1 to 2m - 2
+    float *post_re, *post_im;   // e^(-2 pi i k / n_fft) for k in [0, half]
+    int *filter_start;          // first bin of each mel filter
+    int *filter_len;
+    int *filter_offset;         // into weights
+    float *weights;             // Slaney-normalised triangles
+    float *dct;                 // n_mfcc rows of n_mels, orthonormal DCT-II
+    struct MelTables *next;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    MelTables *entries;
+} mel_cache = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// Slaney's auditory scale, as librosa uses by default: linear below 1 kHz,
+// logarithmic above
+static double hz_to_mel(double hz) {
+    if (hz < 1000.0) return hz * 3.0 / 200.0;
+    return 15.0 + log(hz / 1000.0) * 27.0 / log(6.4);
+}
+
+static double mel_to_hz(double mel) {
+    if (mel < 15.0) return mel * 200.0 / 3.0;
+    return 1000.0 * exp((mel - 15.0) * log(6.4) / 27.0);
+}
+
+static int build_filterbank(MelTables *t) {
+    const MelConfig *c = &t->config;
+    int n = c->n_mels;
+    double fmax = c->fmax > 0 ? c->fmax : t->sample_rate / 2.0;
+    double mel_lo = hz_to_mel(c->fmin), mel_hi = hz_to_mel(fmax);
+    
+    double *edges = malloc((n + 2) * sizeof(double));
+    t->filter_start = calloc(n, sizeof(int));
+    t->filter_len = calloc(n, sizeof(int));
+    t->filter_offset = calloc(n, sizeof(int));
+    t->weights = calloc((size_t)n * t->bins, sizeof(float));
+    if (!edges || !t->filter_start || !t->filter_len || !t->filter_offset || !t->weights) {
+        free(edges);
+        return -1;
+    }
+    for (int i = 0; i < n + 2; i++) edges[i] = mel_to_hz(mel_lo + (mel_hi - mel_lo) * i / (n + 1));
+    
+    // Only the non-zero span of each triangle is stored
+    int offset = 0;
+    for (int m = 0; m < n; m++) {
+        double lo = edges[m], center = edges[m + 1], hi = edges[m + 2];
+        double norm = 2.0 / (hi - lo);
+        int start = -1, len = 0;
+        for (int k = 0; k < t->bins; k++) {
+            double f = (double)k * t->sample_rate / c->n_fft;
+            double w = fmin((f - lo) / (center - lo), (hi - f) / (hi - center));
+            if (w <= 0) {
+                if (start >= 0) break;
+                continue;
+            }
+            if (start < 0) start = k;
+            t->weights[offset + len++] = (float)(w * norm);
+        }
+        t->filter_start[m] = start < 0 ? 0 : start;
+        t->filter_len[m] = len;
+        t->filter_offset[m] = offset;
+        offset += len;
+    }
+    free(edges);
+    return 0;
+}
+
+static void mel_tables_free(MelTables *t) {
+    free(t->window);
+    free(t->bitrev);
+    free(t->tw_re);
+    free(t->tw_im);
+    free(t->post_re);
+    free(t->post_im);
+    free(t->filter_start);
+    free(t->filter_len);
+    free(t->filter_offset);
+    free(t->weights);
+    free(t->dct);
+    free(t);
+}
+
+static MelTables *mel_tables_build(int sample_rate, const MelConfig *config) {
+    int n_fft = config->n_fft;
+    if (n_fft < 8 || (n_fft & (n_fft - 1)) || config->hop < 1 || config->hop > n_fft ||
+        config->n_mels < 1 || config->n_mfcc < 0 || config->n_mfcc > config->n_mels || config->fmin < 0 ||
+        (config->fmax > 0 && config->fmax <= config->fmin) || config->fmax > sample_rate / 2.0f) {
+        return NULL;
+    }
+    
+    MelTables *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->sample_rate = sample_rate;
+    t->config = *config;
+    t->half = n_fft / 2;
+    t->bins = n_fft / 2 + 1;
+    
+    t->window = malloc(n_fft * sizeof(float));
+    t->bitrev = malloc(t->half * sizeof(uint32_t));
+    t->tw_re = malloc(t->half * sizeof(float));
+    t->tw_im = malloc(t->half * sizeof(float));
+    t->post_re = malloc(t->bins * sizeof(float));
+    t->post_im = malloc(t->bins * sizeof(float));
+    t->dct = malloc(((size_t)config->n_mfcc * config->n_mels + 1) * sizeof(float));
+    if (!t->window || !t->bitrev || !t->tw_re || !t->tw_im || !t->post_re || !t->post_im || !t->dct ||
+        build_filterbank(t) < 0) {
+        mel_tables_free(t);
+        return NULL;
+    }
+    
+    for (int i = 0; i < n_fft; i++) t->window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / n_fft));
+    
+    int bits = 0;
+    while ((1 << bits) < t->half) bits++;
+    for (int i = 0; i < t->half; i++) {
+        uint32_t r = 0;
+        for (int b = 0; b < bits; b++) r |= ((i >> b) & 1) << (bits - 1 - b);
+        t->bitrev[i] = r;
+    }
+    
+    for (int m = 1; m < t->half; m *= 2) {
+        for (int j = 0; j < m; j++) {
+            t->tw_re[m - 1 + j] = (float)cos(M_PI * j / m);
+            t->tw_im[m - 1 + j] = (float)-sin(M_PI * j / m);
+        }
+    }
+    for (int k = 0; k < t->bins; k++) {
+        t->post_re[k] = (float)cos(2.0 * M_PI * k / n_fft);
+        t->post_im[k] = (float)-sin(2.0 * M_PI * k / n_fft);
+    }
+    for (int j = 0; j < config->n_mfcc; j++) {
+        double scale = sqrt((j ? 2.0 : 1.0) / config->n_mels);
+        for (int i = 0; i < config->n_mels; i++) {
+            t->dct[j * config->n_mels + i] = (float)(scale * cos(M_PI * j * (i + 0.5) / config->n_mels));
+        }
+    }
+    return t;
+}
+
+const MelTables *mel_tables_get(int sample_rate, const MelConfig *config) {
+    pthread_mutex_lock(&mel_cache.mutex);
+    MelTables *t = mel_cache.entries;
+    for (; t; t = t->next) {
+        if (t->sample_rate == sample_rate && memcmp(&t->config, config, sizeof(MelConfig)) == 0) break;
+    }
+    if (!t && (t = mel_tables_build(sample_rate, config))) {
+        t->next = mel_cache.entries;
+        mel_cache.entries = t;
+    }
+    pthread_mutex_unlock(&mel_cache.mutex);
+    return t;
+}
+
+int mel_tables_n_mels(const MelTables *tables) {
+    return tables->config.n_mels;
+}
+
+int mel_summary_size(const MelTables *tables) {
+    return MEL_STAT_MFCC + 2 * tables->config.n_mfcc;
+}
+
+// One radix-2 stage over blocks of 2m points
+static void fft_stage_scalar(float *re, float *im, int n, int m, const float *wr, const float *wi) {
+    for (int k = 0; k < n; k += 2 * m) {
+        for (int j = 0; j < m; j++) {
+            float *ar = re + k + j, *ai = im + k + j;
+            float *br = ar + m, *bi = ai + m;
+            float tr = *br * wr[j] - *bi * wi[j];
+            float ti = *br * wi[j] + *bi * wr[j];
+            *br = *ar - tr;
+            *bi = *ai - ti;
+            *ar += tr;
+            *ai += ti;
+        }
+    }
+}
+
+#if defined(__SSE__) || defined(__x86_64__)
+static void fft_stage_simd(float *re, float *im, int n, int m, const float *wr, const float *wi) {
+    for (int k = 0; k < n; k += 2 * m) {
+        for (int j = 0; j < m; j += 4) {
+            float *ar = re + k + j, *ai = im + k + j;
+            __m128 xr = _mm_loadu_ps(ar), xi = _mm_loadu_ps(ai);
+            __m128 yr = _mm_loadu_ps(ar + m), yi = _mm_loadu_ps(ai + m);
+            __m128 cr = _mm_loadu_ps(wr + j), ci = _mm_loadu_ps(wi + j);
+            __m128 tr = _mm_sub_ps(_mm_mul_ps(yr, cr), _mm_mul_ps(yi, ci));
+            __m128 ti = _mm_add_ps(_mm_mul_ps(yr, ci), _mm_mul_ps(yi, cr));
+            _mm_storeu_ps(ar + m, _mm_sub_ps(xr, tr));
+            _mm_storeu_ps(ai + m, _mm_sub_ps(xi, ti));
+            _mm_storeu_ps(ar, _mm_add_ps(xr, tr));
+            _mm_storeu_ps(ai, _mm_add_ps(xi, ti));
+        }
+    }
+}
+
+static float hsum_ps(__m128 v) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+static float vec_dot(const float *a, const float *b, int n) {
+    __m128 acc = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    float sum = hsum_ps(acc);
+    for (; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+// Pairs (x[i - 1], x[i]) whose sign bits differ
+static int vec_sign_changes(const float *x, int n) {
+    __m128i acc = _mm_setzero_si128();
+    int i = 1;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_castps_si128(_mm_loadu_ps(x + i - 1));
+        __m128i b = _mm_castps_si128(_mm_loadu_ps(x + i));
+        acc = _mm_add_epi32(acc, _mm_srli_epi32(_mm_xor_si128(a, b), 31));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    int count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; i++) count += signbit(x[i - 1]) != signbit(x[i]);
+    return count;
+}
+
+// Sum of the magnitudes and of the magnitudes weighted by bin index
+static void vec_magnitude_moments(const float *power, int n, float *sum, float *weighted) {
+    __m128 acc = _mm_setzero_ps(), wacc = _mm_setzero_ps();
+    __m128 index = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f), step = _mm_set1_ps(4.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 mag = _mm_sqrt_ps(_mm_loadu_ps(power + i));
+        acc = _mm_add_ps(acc, mag);
+        wacc = _mm_add_ps(wacc, _mm_mul_ps(mag, index));
+        index = _mm_add_ps(index, step);
+    }
+    *sum = hsum_ps(acc);
+    *weighted = hsum_ps(wacc);
+    for (; i < n; i++) {
+        float mag = sqrtf(power[i]);
+        *sum += mag;
+        *weighted += mag * i;
+    }
+}
+#define MEL_KERNEL_NAME "sse"
+#elif defined(__ARM_NEON)
+static void fft_stage_simd(float *re, float *im, int n, int m, const float *wr, const float *wi) {
+    for (int k = 0; k < n; k += 2 * m) {
+        for (int j = 0; j < m; j += 4) {
+            float *ar = re + k + j, *ai = im + k + j;
+            float32x4_t xr = vld1q_f32(ar), xi = vld1q_f32(ai);
+            float32x4_t yr = vld1q_f32(ar + m), yi = vld1q_f32(ai + m);
+            float32x4_t cr = vld1q_f32(wr + j), ci = vld1q_f32(wi + j);
+            float32x4_t tr = vsubq_f32(vmulq_f32(yr, cr), vmulq_f32(yi, ci));
+            float32x4_t ti = vaddq_f32(vmulq_f32(yr, ci), vmulq_f32(yi, cr));
+            vst1q_f32(ar + m, vsubq_f32(xr, tr));
+            vst1q_f32(ai + m, vsubq_f32(xi, ti));
+            vst1q_f32(ar, vaddq_f32(xr, tr));
+            vst1q_f32(ai, vaddq_f32(xi, ti));
+        }
+    }
+}
+
+static float vec_dot(const float *a, const float *b, int n) {
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    float lanes[4];
+    vst1q_f32(lanes, acc);
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+static int vec_sign_changes(const float *x, int n) {
+    uint32x4_t acc = vdupq_n_u32(0);
+    int i = 1;
+    for (; i + 4 <= n; i += 4) {
+        uint32x4_t a = vreinterpretq_u32_f32(vld1q_f32(x + i - 1));
+        uint32x4_t b = vreinterpretq_u32_f32(vld1q_f32(x + i));
+        acc = vaddq_u32(acc, vshrq_n_u32(veorq_u32(a, b), 31));
+    }
+    uint32_t lanes[4];
+    vst1q_u32(lanes, acc);
+    int count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; i++) count += signbit(x[i - 1]) != signbit(x[i]);
+    return count;
+}
+
+static void vec_magnitude_moments(const float *power, int n, float *sum, float *weighted) {
+    float32x4_t acc = vdupq_n_f32(0.0f), wacc = vdupq_n_f32(0.0f);
+    const float start[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    float32x4_t index = vld1q_f32(start), step = vdupq_n_f32(4.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t mag = vsqrtq_f32(vld1q_f32(power + i));
+        acc = vaddq_f32(acc, mag);
+        wacc = vmlaq_f32(wacc, mag, index);
+        index = vaddq_f32(index, step);
+    }
+    float lanes[4], wlanes[4];
+    vst1q_f32(lanes, acc);
+    vst1q_f32(wlanes, wacc);
+    *sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    *weighted = (wlanes[0] + wlanes[1]) + (wlanes[2] + wlanes[3]);
+    for (; i < n; i++) {
+        float mag = sqrtf(power[i]);
+        *sum += mag;
+        *weighted += mag * i;
+    }
+}
+#define MEL_KERNEL_NAME "neon"
+#else
+#define fft_stage_simd fft_stage_scalar
+
+static float vec_dot(const float *a, const float *b, int n) {
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+static int vec_sign_changes(const float *x, int n) {
+    int count = 0;
+    for (int i = 1; i < n; i++) count += signbit(x[i - 1]) != signbit(x[i]);
+    return count;
+}
+
+static void vec_magnitude_moments(const float *power, int n, float *sum, float *weighted) {
+    *sum = *weighted = 0.0f;
+    for (int i = 0; i < n; i++) {
+        float mag = sqrtf(power[i]);
+        *sum += mag;
+        *weighted += mag * i;
+    }
+}
+#define MEL_KERNEL_NAME "scalar"
+#endif
+
+const char *mel_kernel_name(void) {
+    return MEL_KERNEL_NAME;
+}
+
+// Power spectrum of the n_fft windowed samples in m->buf into m->power
+static void mel_power_spectrum(MelExtractor *m) {
+    const MelTables *t = m->tables;
+    int half = t->half;
+    float *re = m->re, *im = m->im;
+    
+    // Even samples become the real parts, odd ones the imaginary parts
+    for (int i = 0; i < half; i++) {
+        uint32_t r = t->bitrev[i];
+        re[r] = m->buf[2 * i] * t->window[2 * i];
+        im[r] = m->buf[2 * i + 1] * t->window[2 * i + 1];
+    }
+    
+    for (int s = 1; s < half; s *= 2) {
+        if (s < 4) fft_stage_scalar(re, im, half, s, t->tw_re + s - 1, t->tw_im + s - 1);
+        else fft_stage_simd(re, im, half, s, t->tw_re + s - 1, t->tw_im + s - 1);
+    }
+    
+    // Split the half-size transform into the spectrum of the real input
+    for (int k = 0; k <= half; k++) {
+        int a = k % half, b = (half - k) % half;
+        float er = 0.5f * (re[a] + re[b]), ei = 0.5f * (im[a] - im[b]);
+        float or = 0.5f * (im[a] + im[b]), oi = -0.5f * (re[a] - re[b]);
+        float xr = er + t->post_re[k] * or - t->post_im[k] * oi;
+        float xi = ei + t->post_re[k] * oi + t->post_im[k] * or;
+        m->power[k] = xr * xr + xi * xi;
+    }
+}
+
+// Adds the statistics of the current frame: its samples are still in buf,
+// its spectrum in power and its log-mel values in logmel
+static void mel_frame_stats(MelExtractor *m, const float *logmel) {
+    const MelTables *t = m->tables;
+    int n_fft = t->config.n_fft;
+    int n_mels = t->config.n_mels;
+    
+    double rms = sqrt(vec_dot(m->buf, m->buf, n_fft) / n_fft);
+    m->rms_sum += rms;
+    if (rms > m->rms_max) m->rms_max = rms;
+    m->zcr_sum += (double)vec_sign_changes(m->buf, n_fft) / n_fft;
+    
+    float mag, weighted;
+    vec_magnitude_moments(m->power, t->bins, &mag, &weighted);
+    if (mag > 0.0f) m->centroid_sum += (double)weighted / mag * t->sample_rate / n_fft;
+    
+    // The DCT is linear, so the dB scaling is applied to its output
+    for (int j = 0; j < t->config.n_mfcc; j++) {
+        double c = MEL_DB_PER_NEPER * vec_dot(t->dct + j * n_mels, logmel, n_mels);
+        m->mfcc_sum[j] += c;
+        m->mfcc_sq[j] += c * c;
+    }
+}
+
+static int mel_frame(MelExtractor *m) {
+    const MelTables *t = m->tables;
+    int n_mels = t->config.n_mels;
+    float *dst = m->logmel;
+    
+    if (m->flags & MEL_KEEP_FRAMES) {
+        if (m->frames >= m->capacity) {
+            size_t capacity = m->capacity ? m->capacity * 2 : 256;
+            float *out = realloc(m->out, capacity * n_mels * sizeof(float));
+            if (!out) return -1;
+            m->out = out;
+            m->capacity = capacity;
+        }
+        dst = m->out + m->frames * n_mels;
+    }
+    
+    mel_power_spectrum(m);
+    for (int i = 0; i < n_mels; i++) {
+        float sum = vec_dot(t->weights + t->filter_offset[i], m->power + t->filter_start[i], t->filter_len[i]);
+        dst[i] = logf(sum > MEL_LOG_FLOOR ? sum : MEL_LOG_FLOOR);
+    }
+    if (m->flags & MEL_FRAME_STATS) mel_frame_stats(m, dst);
+    m->frames++;
+    return 0;
+}
+
+int mel_extractor_init(MelExtractor *m, const MelTables *tables, int flags) {
+    int n_mfcc = tables->config.n_mfcc;
+    
+    memset(m, 0, sizeof(*m));
+    m->tables = tables;
+    m->flags = flags;
+    m->buf = malloc(tables->config.n_fft * sizeof(float));
+    m->re = malloc(tables->half * sizeof(float));
+    m->im = malloc(tables->half * sizeof(float));
+    m->power = malloc(tables->bins * sizeof(float));
+    m->logmel = malloc(tables->config.n_mels * sizeof(float));
+    m->mfcc_sum = calloc(n_mfcc + 1, sizeof(double));
+    m->mfcc_sq = calloc(n_mfcc + 1, sizeof(double));
+    if (!m->buf || !m->re || !m->im || !m->power || !m->logmel || !m->mfcc_sum || !m->mfcc_sq) {
+        mel_extractor_free(m);
+        return -1;
+    }
+    return 0;
+}
+
+void mel_extractor_free(MelExtractor *m) {
+    free(m->buf);
+    free(m->re);
+    free(m->im);
+    free(m->power);
+    free(m->logmel);
+    free(m->out);
+    free(m->mfcc_sum);
+    free(m->mfcc_sq);
+    memset(m, 0, sizeof(*m));
+}
+
+void mel_extractor_summary(const MelExtractor *m, float *out) {
+    int n_mfcc = m->tables->config.n_mfcc;
+    
+    memset(out, 0, mel_summary_size(m->tables) * sizeof(float));
+    if (!m->frames || !(m->flags & MEL_FRAME_STATS)) return;
+    
+    double n = (double)m->frames;
+    out[MEL_STAT_RMS_MEAN] = (float)(m->rms_sum / n);
+    out[MEL_STAT_RMS_MAX] = (float)m->rms_max;
+    out[MEL_STAT_ZCR_MEAN] = (float)(m->zcr_sum / n);
+    out[MEL_STAT_CENTROID_MEAN] = (float)(m->centroid_sum / n);
+    for (int j = 0; j < n_mfcc; j++) {
+        double mean = m->mfcc_sum[j] / n;
+        double var = m->mfcc_sq[j] / n - mean * mean;
+        out[MEL_STAT_MFCC + j] = (float)mean;
+        out[MEL_STAT_MFCC + n_mfcc + j] = (float)sqrt(var > 0.0 ? var : 0.0);
+    }
+}
+
+int mel_extractor_push(MelExtractor *m, const float *samples, size_t frames, int channels) {
+    int n_fft = m->tables->config.n_fft;
+    int hop = m->tables->config.hop;
+    float scale = 1.0f / channels;
+    
+    while (frames > 0) {
+        size_t take = n_fft - m->fill;
+        if (take > frames) take = frames;
+        
+        float *dst = m->buf + m->fill;
+        if (!samples) {
+            memset(dst, 0, take * sizeof(float));
+        } else if (channels == 1) {
+            memcpy(dst, samples, take * sizeof(float));
+        } else {
+            for (size_t i = 0; i < take; i++) {
+                float sum = 0.0f;
+                for (int c = 0; c < channels; c++) sum += samples[i * channels + c];
+                dst[i] = sum * scale;
+            }
+        }
+        if (samples) samples += take * channels;
+        m->fill += take;
+        frames -= take;
+        
+        if (m->fill == n_fft) {
+            if (mel_frame(m) < 0) return -1;
+            memmove(m->buf, m->buf + hop, (n_fft - hop) * sizeof(float));
+            m->fill = n_fft - hop;
+        }
+    }
+    return 0;
+}
+
+int vad_gate_init(VadGate *g, const VadConfig *config, int sample_rate, int channels, size_t max_frames) {
+    memset(g, 0, sizeof(*g));
+    g->channels = channels;
+    g->frame_len = sample_rate * VAD_FRAME_MS / 1000;
+    if (g->frame_len < 1) g->frame_len = 1;
+    g->threshold = powf(10.0f, config->threshold_db / 10.0f);
+    g->hangover = (size_t)sample_rate * config->hangover_ms / 1000;
+    g->pending_max = max_frames;
+    
+    g->frame = malloc((size_t)g->frame_len * channels * sizeof(float));
+    g->lead = malloc((g->hangover + g->frame_len) * channels * sizeof(float));
+    if (!g->frame || !g->lead) {
+        vad_gate_free(g);
+        return -1;
+    }
+    return 0;
+}
+
+void vad_gate_free(VadGate *g) {
+    free(g->frame);
+    free(g->lead);
+    free(g->pending);
+    memset(g, 0, sizeof(*g));
+}
+
+// Holds silence after an active frame, up to pending_max frames
+static int vad_hold_pending(VadGate *g, const float *samples, size_t frames) {
+    if (frames > g->pending_max - g->pending_len) frames = g->pending_max - g->pending_len;
+    if (frames == 0) return 0;
+    
+    if (g->pending_len + frames > g->pending_cap) {
+        size_t cap = g->pending_cap ? g->pending_cap * 2 : (size_t)g->frame_len * 16;
+        while (cap < g->pending_len + frames) cap *= 2;
+        if (cap > g->pending_max) cap = g->pending_max;
+        float *pending = realloc(g->pending, cap * g->channels * sizeof(float));
+        if (!pending) return -1;
+        g->pending = pending;
+        g->pending_cap = cap;
+    }
+    memcpy(g->pending + g->pending_len * g->channels, samples, frames * g->channels * sizeof(float));
+    g->pending_len += frames;
+    return 0;
+}
+
+static int vad_gate_frame(VadGate *g, const float *samples, int frames, VadEmit emit, void *opaque) {
+    int n = frames * g->channels;
+    int ret = 0;
+    
+    if (vec_dot(samples, samples, n) > g->threshold * n) {
+        if (!g->started) {
+            g->started = 1;
+            if (g->lead_len) ret = emit(opaque, g->lead, g->lead_len);
+        } else if (g->pending_len) {
+            ret = emit(opaque, g->pending, g->pending_len);
+        }
+        g->lead_len = 0;
+        g->pending_len = 0;
+        return ret < 0 ? ret : emit(opaque, samples, frames);
+    }
+    
+    if (g->started) return vad_hold_pending(g, samples, frames);
+    
+    // Before the start only the last hangover frames are kept
+    memcpy(g->lead + g->lead_len * g->channels, samples, (size_t)n * sizeof(float));
+    g->lead_len += frames;
+    if (g->lead_len > g->hangover) {
+        size_t drop = g->lead_len - g->hangover;
+        memmove(g->lead, g->lead + drop * g->channels, g->hangover * g->channels * sizeof(float));
+        g->lead_len = g->hangover;
+    }
+    return 0;
+}
+
+int vad_gate_push(VadGate *g, const float *samples, size_t frames, VadEmit emit, void *opaque) {
+    while (frames > 0) {
+        int ret;
+        if (g->fill == 0 && frames >= (size_t)g->frame_len) {
+            // Whole frames are classified where they are
+            ret = vad_gate_frame(g, samples, g->frame_len, emit, opaque);
+            samples += (size_t)g->frame_len * g->channels;
+            frames -= g->frame_len;
+        } else {
+            size_t take = g->frame_len - g->fill;
+            if (take > frames) take = frames;
+            memcpy(g->frame + (size_t)g->fill * g->channels, samples, take * g->channels * sizeof(float));
+            g->fill += take;
+            samples += take * g->channels;
+            frames -= take;
+            if (g->fill < g->frame_len) break;
+            
+            g->fill = 0;
+            ret = vad_gate_frame(g, g->frame, g->frame_len, emit, opaque);
+        }
+        if (ret < 0) return ret;
+    }
+    return 0;
+}
+
+int vad_gate_flush(VadGate *g, VadEmit emit, void *opaque) {
+    int ret = 0;
+    
+    if (g->fill > 0) {
+        ret = vad_gate_frame(g, g->frame, g->fill, emit, opaque);
+        g->fill = 0;
+    }
+    if (ret == 0 && g->started && g->pending_len) {
+        ret = emit(opaque, g->pending, g->pending_len < g->hangover ? g->pending_len : g->hangover);
+    }
+    g->pending_len = 0;
+    return ret;
+}
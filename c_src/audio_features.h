@@ -0,0 +1,128 @@
+#ifndef AUDIO_FEATURES_H
+#define AUDIO_FEATURES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log-mel spectrogram parameters. n_fft must be a power of two and hop at
+// most n_fft; fmax 0 means the Nyquist frequency. n_mfcc, at most n_mels,
+// is only used by the frame statistics.
+typedef struct {
+    int n_fft;
+    int hop;
+    int n_mels;
+    float fmin;
+    float fmax;
+    int n_mfcc;
+} MelConfig;
+
+// 32 ms window, 10 ms hop at 16 kHz
+#define MEL_DEFAULT_N_FFT 512
+#define MEL_DEFAULT_HOP 160
+#define MEL_DEFAULT_N_MELS 80
+#define MEL_DEFAULT_N_MFCC 20
+
+// Window, FFT twiddles and filterbank for one sample rate and MelConfig.
+// Built once and shared by every extractor; never freed.
+typedef struct MelTables MelTables;
+
+// Returns the cached tables, building them on first use. Thread-safe.
+// NULL when the parameters are invalid or memory runs out.
+const MelTables *mel_tables_get(int sample_rate, const MelConfig *config);
+
+// What an extractor does with each frame
+#define MEL_KEEP_FRAMES 1   // append the log-mel values to out
+#define MEL_FRAME_STATS 2   // accumulate the per-file summary
+
+// Per-file summary layout: these means, then n_mfcc MFCC means and n_mfcc
+// MFCC standard deviations
+enum {
+    MEL_STAT_RMS_MEAN,
+    MEL_STAT_RMS_MAX,
+    MEL_STAT_ZCR_MEAN,      // sign changes per sample
+    MEL_STAT_CENTROID_MEAN, // Hz
+    MEL_STAT_MFCC
+};
+
+// Streaming extractor: interleaved samples go in, are mixed down to mono
+// and cut into frames of n_fft every hop samples (no centre padding); each
+// frame becomes n_mels values of ln(max(mel power, 1e-10)).
+typedef struct {
+    const MelTables *tables;
+    int flags;
+    float *buf;             // samples of the next frame
+    int fill;
+    float *re, *im, *power;
+    float *logmel;          // current frame when it is not kept
+    float *out;             // frames * n_mels values
+    size_t frames;
+    size_t capacity;
+    // Running sums over the frames for MEL_FRAME_STATS
+    double rms_sum, rms_max, zcr_sum, centroid_sum;
+    double *mfcc_sum, *mfcc_sq;
+} MelExtractor;
+
+int mel_extractor_init(MelExtractor *m, const MelTables *tables, int flags);
+void mel_extractor_free(MelExtractor *m);
+
+// Appends frames of interleaved samples, or silence when samples is NULL
+int mel_extractor_push(MelExtractor *m, const float *samples, size_t frames, int channels);
+
+int mel_tables_n_mels(const MelTables *tables);
+
+// Values in the summary of an extractor built on these tables
+int mel_summary_size(const MelTables *tables);
+
+// Fills the MEL_STAT_* summary of the frames pushed so far, all zero when
+// there were none. MFCCs are the orthonormal DCT-II of the log-mel values
+// in dB.
+void mel_extractor_summary(const MelExtractor *m, float *out);
+
+// Name of the FFT and frame statistics kernels compiled in
+const char *mel_kernel_name(void);
+
+// Energy voice activity gate. Each VAD_FRAME_MS of audio is active when its
+// mean power, over all channels, is above threshold_db dBFS. Silence before
+// the first and after the last active frame is dropped except for the
+// hangover_ms next to it; silence in between is kept.
+#define VAD_FRAME_MS 20
+#define VAD_DEFAULT_HANGOVER_MS 200
+
+typedef struct {
+    float threshold_db;
+    int hangover_ms;
+} VadConfig;
+
+// Receives the audio the gate lets through. A negative return is passed
+// back to the caller of vad_gate_push() or vad_gate_flush().
+typedef int (*VadEmit)(void *opaque, const float *samples, size_t frames);
+
+typedef struct {
+    int channels;
+    int frame_len;          // frames per analysis frame
+    float threshold;        // mean power
+    size_t hangover;        // frames
+    int started;            // an active frame has been seen
+    float *frame;           // analysis frame being filled
+    int fill;
+    float *lead;            // up to hangover frames of silence before the start
+    size_t lead_len;
+    float *pending;         // silence since the last active frame
+    size_t pending_len;
+    size_t pending_cap;
+    size_t pending_max;
+} VadGate;
+
+// max_frames must be the most output the consumer takes: longer silences
+// are only held up to it, since anything after could never be written.
+// Consumers that take unbounded output cannot use the gate.
+int vad_gate_init(VadGate *g, const VadConfig *config, int sample_rate, int channels, size_t max_frames);
+void vad_gate_free(VadGate *g);
+
+int vad_gate_push(VadGate *g, const float *samples, size_t frames, VadEmit emit, void *opaque);
+
+// Ends the input: classifies the partial frame and emits the hangover of
+// the trailing silence
+int vad_gate_flush(VadGate *g, VadEmit emit, void *opaque);
+
+#endif
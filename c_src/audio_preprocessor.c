@@ -1,10 +1,25 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -12,23 +27,88 @@
 #include <libavutil/channel_layout.h>
 #include <libswresample/swresample.h>
 
+#include "audio_features.h"
+#include "decimator.h"
+#include "io_engine.h"
+#include "sample_format.h"
+#include "scheduler.h"
+#include "xxhash.h"
+
+typedef enum {
+    OUTPUT_WAV,
+    OUTPUT_FLAC,
+    OUTPUT_OPUS
+} OutputCodec;
+
+typedef enum {
+    FEATURES_NONE,
+    FEATURES_WITH_AUDIO,        // <name>.mel.npy next to the audio
+    FEATURES_ONLY               // <name>.mel.npy instead of the audio
+} FeatureOutput;
+
 typedef struct {
     uint32_t target_sample_rate;
     float min_duration_sec;
     float max_duration_sec;
+    int use_decimator;
+    int use_mmap;
+    float split_sec;
+    SampleFormat sample_format;
+    OutputCodec codec;
+    int bitrate;                // opus only
+    int encoder_threads;
+    FeatureOutput features;
+    int stats;                  // per-file feature statistics
+    MelConfig mel;
+    int trim_silence;           // drop leading and trailing silence
+    VadConfig vad;
+    int segment;                // clips of max_duration instead of truncating
+    float segment_overlap_sec;
 } ProcessorConfig;
 
 typedef struct {
     char *input_path;
     char *output_path;
+    // Where the output is written until it is complete
+    char *part_path;
+    // Cache entry to store the output under, set on a cache miss
+    char *cache_path;
     ProcessorConfig config;
+    IoPrefetch *prefetch;
+    atomic_int prefetch_state;
+    uint64_t input_size;
+    int64_t input_mtime_ns;
+    double est_cost;
+    // Row of the --npy array
+    long row;
+    // Allocated on its own by streaming discovery; freed once reported
+    int streamed;
 } ProcessTask;
 
+// Who owns a task's read-ahead. The worker that will process the task and
+// any worker prefetching ahead of its own deque race for it with a CAS.
+enum {
+    PREFETCH_IDLE,
+    PREFETCH_ISSUING,
+    PREFETCH_READY,
+    PREFETCH_CLAIMED
+};
+
+typedef enum {
+    SCHEDULE_READDIR,
+    SCHEDULE_SIZE,
+    SCHEDULE_DURATION,
+    SCHEDULE_STREAM
+} ScheduleMode;
+
 typedef struct {
     ProcessTask *tasks;
     int task_count;
-    int next_task;
-    pthread_mutex_t mutex;
+    int num_threads;
+    WorkScheduler sched;
+    atomic_int next_worker;
+    IoEngine *io;
+    int prefetch_window;
 } ThreadPool;
 
 static int is_audio_file(const char *filename) {
@@ -44,388 +124,4264 @@ static int is_audio_file(const char *filename) {
     return 0;
 }
 
-static int process_file(const char *input_path, const char *output_path, ProcessorConfig *config) {
-    AVFormatContext *in_fmt_ctx = NULL;
-    AVFormatContext *out_fmt_ctx = NULL;
-    AVCodecContext *dec_ctx = NULL;
-    AVCodecContext *enc_ctx = NULL;
-    SwrContext *swr_ctx = NULL;
-    AVFrame *dec_frame = NULL;
-    AVFrame *enc_frame = NULL;
-    AVPacket *pkt = NULL;
-    AVPacket *out_pkt = NULL;
+// Compressed output (--codec flac|opus). Instead of staging raw bytes, the
+// writer hands its samples to an FFmpeg encoder: they are converted into
+// the pending encoder frame, which is encoded and muxed once it is full.
+#define OPUS_DEFAULT_BITRATE 32000
+#define ENCODER_FRAME_SIZE 4096     // for encoders without a fixed frame size
+
+typedef struct OutputEncoder {
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *enc_ctx;
+    AVStream *stream;
+    AVFrame *frame;
+    AVPacket *pkt;
+    int frame_size;
+    int fill;                   // frames in the pending encoder frame
+    int64_t pts;
+} OutputEncoder;
+
+#define MEL_EXTENSION ".mel.npy"
+
+static const char *output_extension(const ProcessorConfig *config) {
+    if (config->features == FEATURES_ONLY) return MEL_EXTENSION;
+    switch (config->codec) {
+    case OUTPUT_FLAC:
+        return ".flac";
+    case OUTPUT_OPUS:
+        return ".opus";
+    default:
+        return ".wav";
+    }
+}
+
+static void output_encoder_free(OutputEncoder *e) {
+    if (e->fmt_ctx) {
+        if (e->fmt_ctx->pb) avio_closep(&e->fmt_ctx->pb);
+        avformat_free_context(e->fmt_ctx);
+    }
+    avcodec_free_context(&e->enc_ctx);
+    av_frame_free(&e->frame);
+    av_packet_free(&e->pkt);
+    free(e);
+}
+
+static int output_encoder_open(OutputEncoder **out, const char *path, int sample_rate, int channels,
+                               const ProcessorConfig *config) {
+    int opus = config->codec == OUTPUT_OPUS;
+    const AVCodec *codec = opus ? avcodec_find_encoder_by_name("libopus") : avcodec_find_encoder(AV_CODEC_ID_FLAC);
+    if (!codec) return AVERROR_ENCODER_NOT_FOUND;
+    
+    OutputEncoder *e = calloc(1, sizeof(*e));
+    if (!e) return AVERROR(ENOMEM);
+    
+    int ret = avformat_alloc_output_context2(&e->fmt_ctx, NULL, opus ? "ogg" : "flac", path);
+    if (ret < 0) goto fail;
+    
+    e->enc_ctx = avcodec_alloc_context3(codec);
+    e->frame = av_frame_alloc();
+    e->pkt = av_packet_alloc();
+    if (!e->enc_ctx || !e->frame || !e->pkt) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    
+    AVCodecContext *enc = e->enc_ctx;
+    enc->sample_rate = sample_rate;
+    enc->time_base = (AVRational){1, sample_rate};
+    av_channel_layout_default(&enc->ch_layout, channels);
+    if (opus) {
+        enc->sample_fmt = AV_SAMPLE_FMT_FLT;
+        enc->bit_rate = config->bitrate;
+    } else if (config->sample_format == SAMPLE_FORMAT_S24) {
+        enc->sample_fmt = AV_SAMPLE_FMT_S32;
+        enc->bits_per_raw_sample = 24;
+    } else {
+        enc->sample_fmt = AV_SAMPLE_FMT_S16;
+    }
+    // The workers already encode separate files in parallel; cores left
+    // over go to encoders that can thread within a file
+    enc->thread_count = config->encoder_threads;
+    enc->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if (e->fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    
+    ret = avcodec_open2(enc, codec, NULL);
+    if (ret < 0) goto fail;
+    
+    e->stream = avformat_new_stream(e->fmt_ctx, NULL);
+    if (!e->stream) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    ret = avcodec_parameters_from_context(e->stream->codecpar, enc);
+    if (ret < 0) goto fail;
+    e->stream->time_base = enc->time_base;
+    
+    ret = avio_open(&e->fmt_ctx->pb, path, AVIO_FLAG_WRITE);
+    if (ret < 0) goto fail;
+    ret = avformat_write_header(e->fmt_ctx, NULL);
+    if (ret < 0) goto fail;
+    
+    e->frame_size = enc->frame_size > 0 ? enc->frame_size : ENCODER_FRAME_SIZE;
+    e->frame->nb_samples = e->frame_size;
+    e->frame->format = enc->sample_fmt;
+    e->frame->sample_rate = sample_rate;
+    ret = av_channel_layout_copy(&e->frame->ch_layout, &enc->ch_layout);
+    if (ret < 0) goto fail;
+    ret = av_frame_get_buffer(e->frame, 0);
+    if (ret < 0) goto fail;
+    
+    *out = e;
+    return 0;
+
+fail:
+    output_encoder_free(e);
+    return ret;
+}
+
+// Sends a frame, or NULL to drain the encoder, and muxes every packet
+// that comes out
+static int output_encoder_send(OutputEncoder *e, AVFrame *frame) {
+    int ret = avcodec_send_frame(e->enc_ctx, frame);
+    while (ret >= 0) {
+        ret = avcodec_receive_packet(e->enc_ctx, e->pkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return 0;
+        if (ret < 0) break;
+        
+        av_packet_rescale_ts(e->pkt, e->enc_ctx->time_base, e->stream->time_base);
+        e->pkt->stream_index = e->stream->index;
+        ret = av_interleaved_write_frame(e->fmt_ctx, e->pkt);
+    }
+    return ret;
+}
+
+// Encodes the pending frame, which may be short at the end of the stream
+static int output_encoder_flush_frame(OutputEncoder *e) {
+    if (e->fill == 0) return 0;
+    
+    e->frame->nb_samples = e->fill;
+    e->frame->pts = e->pts;
+    e->pts += e->fill;
+    e->fill = 0;
+    return output_encoder_send(e, e->frame);
+}
+
+// Appends interleaved float32 frames, or silence when samples is NULL
+static int output_encoder_write(OutputEncoder *e, const float *samples, size_t frames, DitherState *dither) {
+    int channels = e->enc_ctx->ch_layout.nb_channels;
+    int sample_bytes = av_get_bytes_per_sample(e->enc_ctx->sample_fmt);
+    int ret;
+    
+    while (frames > 0) {
+        if (e->fill == 0) {
+            // The encoder may still hold a reference to the last frame
+            e->frame->nb_samples = e->frame_size;
+            if ((ret = av_frame_make_writable(e->frame)) < 0) return ret;
+        }
+        
+        size_t chunk = e->frame_size - e->fill;
+        if (chunk > frames) chunk = frames;
+        size_t n = chunk * channels;
+        uint8_t *dst = e->frame->data[0] + (size_t)e->fill * channels * sample_bytes;
+        
+        if (!samples) {
+            memset(dst, 0, n * sample_bytes);
+        } else if (e->enc_ctx->sample_fmt == AV_SAMPLE_FMT_S16) {
+            sample_convert(SAMPLE_FORMAT_S16, samples, dst, n, dither);
+        } else if (e->enc_ctx->sample_fmt == AV_SAMPLE_FMT_S32) {
+            sample_convert_s24_msb(samples, (int32_t *)dst, n);
+        } else {
+            memcpy(dst, samples, n * sizeof(float));
+        }
+        if (samples) samples += n;
+        e->fill += chunk;
+        frames -= chunk;
+        
+        if (e->fill == e->frame_size && (ret = output_encoder_flush_frame(e)) < 0) return ret;
+    }
+    return 0;
+}
+
+// Encodes what is left, finishes the file and frees the encoder
+static int output_encoder_close(OutputEncoder *e) {
+    int ret = output_encoder_flush_frame(e);
+    if (ret == 0) ret = output_encoder_send(e, NULL);
+    if (ret == 0) ret = av_write_trailer(e->fmt_ctx);
+    
+    int err = avio_closep(&e->fmt_ctx->pb);
+    if (ret == 0) ret = err;
+    output_encoder_free(e);
+    return ret;
+}
+
+// Minimal RIFF/WAVE writer for interleaved samples. Callers pass float32;
+// other output formats are converted as they are staged. Samples are
+// appended through a user-space buffer with plain write() calls and the
+// size fields in the header are patched once the stream is closed.
+#define WAV_WRITER_BUF_SIZE (64 * 1024)
+#define WAV_WRITER_MAX_PENDING 4
+#define WAV_HEADER_SIZE 58                 // WAVEFORMATEX, fact and data chunks
+#define WAV_HEADER_EXTENSIBLE_SIZE 68      // WAVEFORMATEXTENSIBLE and data chunk
+#define WAV_HEADER_MAX_SIZE WAV_HEADER_EXTENSIBLE_SIZE
+#define WAV_FORMAT_IEEE_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+typedef struct {
+    int fd;
+    int channels;
+    int sample_rate;
+    SampleFormat format;
+    int frame_bytes;
+    DitherState dither;
+    uint8_t *buf;
+    size_t buf_len;
+    uint64_t offset;
+    uint64_t frames_written;
+    // With an I/O engine, full buffers are handed off as asynchronous writes
+    IoEngine *io;
+    IoCompletion writes;
+    // Writes a slice of a file owned by a SplitOutput or a pack shard: no
+    // header, and the descriptor stays open on close
+    int shared;
+    // Compressed output: samples go to an encoder instead of the buffer
+    OutputEncoder *encoder;
+    // Feature extraction sees every sample written; with discard set the
+    // samples go nowhere else
+    MelExtractor *mel;
+    int discard;
+    // Pipeline mode: full buffers are handed to the write stage, which
+    // takes ownership of them
+    int (*submit)(void *opaque, uint8_t *buf, size_t len, uint64_t offset);
+    void *submit_opaque;
+} WavWriter;
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = v >> 24;
+}
+
+static uint16_t get_le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int pwrite_all(int fd, const void *data, size_t len, off_t offset) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return AVERROR(errno);
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int wav_header_size(SampleFormat format) {
+    return sample_format_wav_tag(format) == WAV_FORMAT_EXTENSIBLE ? WAV_HEADER_EXTENSIBLE_SIZE : WAV_HEADER_SIZE;
+}
+
+// Builds the header into h, which holds WAV_HEADER_MAX_SIZE bytes, and
+// returns its size. PCM above 16 bits must use WAVE_FORMAT_EXTENSIBLE.
+static int wav_build_header(uint8_t *h, int sample_rate, int channels, SampleFormat format,
+                            uint64_t frames) {
+    int size = wav_header_size(format);
+    int extensible = size == WAV_HEADER_EXTENSIBLE_SIZE;
+    uint32_t block_align = channels * sample_format_bytes(format);
+    uint64_t data_size = frames * block_align;
+    if (data_size > UINT32_MAX - size) data_size = UINT32_MAX - size;
+    
+    memcpy(h, "RIFF", 4);
+    put_le32(h + 4, (uint32_t)(size - 8 + data_size));
+    memcpy(h + 8, "WAVE", 4);
+    
+    // fmt chunk: WAVEFORMATEX with an empty extension, or the 22 bytes of
+    // WAVEFORMATEXTENSIBLE
+    memcpy(h + 12, "fmt ", 4);
+    put_le32(h + 16, extensible ? 40 : 18);
+    put_le16(h + 20, sample_format_wav_tag(format));
+    put_le16(h + 22, channels);
+    put_le32(h + 24, sample_rate);
+    put_le32(h + 28, sample_rate * block_align);
+    put_le16(h + 32, block_align);
+    put_le16(h + 34, sample_format_bits(format));
+    put_le16(h + 36, extensible ? 22 : 0);
+    
+    if (extensible) {
+        put_le16(h + 38, sample_format_bits(format));   // valid bits
+        put_le32(h + 40, 0);                            // no speaker positions
+        // KSDATAFORMAT_SUBTYPE_PCM
+        memcpy(h + 44, "\x01\x00\x00\x00\x00\x00\x10\x00\x80\x00\x00\xaa\x00\x38\x9b\x71", 16);
+        memcpy(h + 60, "data", 4);
+        put_le32(h + 64, (uint32_t)data_size);
+        return size;
+    }
+    
+    // fact chunk, required for non-PCM formats and harmless for PCM
+    memcpy(h + 38, "fact", 4);
+    put_le32(h + 42, 4);
+    put_le32(h + 46, (uint32_t)(data_size / block_align));
+    
+    memcpy(h + 50, "data", 4);
+    put_le32(h + 54, (uint32_t)data_size);
+    return size;
+}
+
+static int wav_writer_flush(WavWriter *w) {
+    int ret;
+    
+    if (w->buf_len == 0) return 0;
+    
+    if (w->io) {
+        uint8_t *next = malloc(WAV_WRITER_BUF_SIZE);
+        if (!next) return AVERROR(ENOMEM);
+        
+        // The engine frees the buffer once the write completes
+        ret = io_engine_write(w->io, &w->writes, w->fd, w->buf, w->buf_len, w->offset);
+        w->buf = next;
+        if (ret == 0) ret = io_completion_wait(&w->writes, WAV_WRITER_MAX_PENDING);
+    } else if (w->submit) {
+        uint8_t *next = malloc(WAV_WRITER_BUF_SIZE);
+        if (!next) return AVERROR(ENOMEM);
+        
+        ret = w->submit(w->submit_opaque, w->buf, w->buf_len, w->offset);
+        w->buf = next;
+    } else {
+        ret = pwrite_all(w->fd, w->buf, w->buf_len, w->offset);
+    }
+    
+    w->offset += w->buf_len;
+    w->buf_len = 0;
+    return ret;
+}
+
+static int wav_writer_open(WavWriter *w, const char *path, int sample_rate, int channels,
+                           SampleFormat format, IoEngine *io) {
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->channels = channels;
+    w->sample_rate = sample_rate;
+    w->format = format;
+    w->frame_bytes = channels * sample_format_bytes(format);
+    dither_init(&w->dither, 0);
+    w->io = io;
+    if (io) io_completion_init(&w->writes);
+    
+    w->buf = malloc(WAV_WRITER_BUF_SIZE);
+    if (!w->buf) return AVERROR(ENOMEM);
+    
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) return AVERROR(errno);
+    
+    // Placeholder header, sizes are patched in wav_writer_close()
+    w->buf_len = wav_build_header(w->buf, sample_rate, channels, format, 0);
+    return 0;
+}
+
+// Writes headerless samples into a file owned by the caller, starting at
+// the given byte offset. The dither is seeded from the offset, so every
+// slice of a file gets its own noise and reruns write the same bytes.
+static int wav_writer_open_at(WavWriter *w, int fd, int sample_rate, int channels, SampleFormat format,
+                              uint64_t offset) {
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->channels = channels;
+    w->sample_rate = sample_rate;
+    w->format = format;
+    w->frame_bytes = channels * sample_format_bytes(format);
+    dither_init(&w->dither, (uint32_t)offset);
+    w->shared = 1;
+    
+    w->buf = malloc(WAV_WRITER_BUF_SIZE);
+    if (!w->buf) return AVERROR(ENOMEM);
+    
+    w->fd = fd;
+    w->offset = offset;
+    return 0;
+}
+
+static int wav_writer_open_shared(WavWriter *w, int fd, int sample_rate, int channels, SampleFormat format,
+                                  uint64_t start_frame) {
+    return wav_writer_open_at(w, fd, sample_rate, channels, format,
+                              wav_header_size(format) + start_frame * channels * sample_format_bytes(format));
+}
+
+// Opens a writer whose samples are compressed into path by an FFmpeg
+// encoder
+static int wav_writer_open_encoded(WavWriter *w, const char *path, int sample_rate, int channels,
+                                   const ProcessorConfig *config) {
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->channels = channels;
+    w->sample_rate = sample_rate;
+    w->format = config->sample_format;
+    dither_init(&w->dither, 0);
+    return output_encoder_open(&w->encoder, path, sample_rate, channels, config);
+}
+
+// Opens a writer that only feeds its feature extractor
+static int wav_writer_open_discard(WavWriter *w, int sample_rate, int channels) {
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->channels = channels;
+    w->sample_rate = sample_rate;
+    w->discard = 1;
+    return 0;
+}
+
+static int wav_writer_attach_mel(WavWriter *w, const ProcessorConfig *config) {
+    const MelTables *tables = mel_tables_get(w->sample_rate, &config->mel);
+    if (!tables) return AVERROR(EINVAL);
+    
+    int flags = (config->features ? MEL_KEEP_FRAMES : 0) | (config->stats ? MEL_FRAME_STATS : 0);
+    w->mel = malloc(sizeof(MelExtractor));
+    if (!w->mel) return AVERROR(ENOMEM);
+    if (mel_extractor_init(w->mel, tables, flags) < 0) {
+        free(w->mel);
+        w->mel = NULL;
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+// Converts straight into the staging buffer, so the narrower formats cost
+// no pass over the samples beyond the one that copies them
+static int wav_writer_write_converted(WavWriter *w, const float *samples, size_t frames) {
+    int ret;
+    
+    while (frames > 0) {
+        size_t space = (WAV_WRITER_BUF_SIZE - w->buf_len) / w->frame_bytes;
+        if (space == 0) {
+            if ((ret = wav_writer_flush(w)) < 0) return ret;
+            continue;
+        }
+        size_t chunk = frames < space ? frames : space;
+        sample_convert(w->format, samples, w->buf + w->buf_len, chunk * w->channels, &w->dither);
+        w->buf_len += chunk * w->frame_bytes;
+        samples += chunk * w->channels;
+        frames -= chunk;
+    }
+    return 0;
+}
+
+static int wav_writer_write(WavWriter *w, const float *samples, size_t frames) {
+    const uint8_t *p = (const uint8_t *)samples;
+    size_t bytes = frames * w->channels * sizeof(float);
+    int ret;
+    
+    w->frames_written += frames;
+    if (w->mel && mel_extractor_push(w->mel, samples, frames, w->channels) < 0) return AVERROR(ENOMEM);
+    if (w->discard) return 0;
+    if (w->encoder) return output_encoder_write(w->encoder, samples, frames, &w->dither);
+    if (w->format != SAMPLE_FORMAT_F32) return wav_writer_write_converted(w, samples, frames);
+    
+    // Large synchronous writes skip the staging buffer entirely
+    if (!w->io && !w->submit && w->buf_len + bytes > WAV_WRITER_BUF_SIZE && bytes >= WAV_WRITER_BUF_SIZE / 2) {
+        if ((ret = wav_writer_flush(w)) < 0) return ret;
+        ret = pwrite_all(w->fd, p, bytes, w->offset);
+        w->offset += bytes;
+        return ret;
+    }
+    
+    while (bytes > 0) {
+        size_t space = WAV_WRITER_BUF_SIZE - w->buf_len;
+        if (space == 0) {
+            if ((ret = wav_writer_flush(w)) < 0) return ret;
+            continue;
+        }
+        size_t chunk = bytes < space ? bytes : space;
+        memcpy(w->buf + w->buf_len, p, chunk);
+        w->buf_len += chunk;
+        p += chunk;
+        bytes -= chunk;
+    }
+    return 0;
+}
+
+static int wav_writer_write_silence(WavWriter *w, size_t frames) {
+    size_t frame_bytes = w->frame_bytes;
+    int ret;
+    
+    w->frames_written += frames;
+    if (w->mel && mel_extractor_push(w->mel, NULL, frames, w->channels) < 0) return AVERROR(ENOMEM);
+    if (w->discard) return 0;
+    if (w->encoder) return output_encoder_write(w->encoder, NULL, frames, &w->dither);
+    
+    while (frames > 0) {
+        size_t space = (WAV_WRITER_BUF_SIZE - w->buf_len) / frame_bytes;
+        if (space == 0) {
+            if ((ret = wav_writer_flush(w)) < 0) return ret;
+            continue;
+        }
+        size_t chunk = frames < space ? frames : space;
+        memset(w->buf + w->buf_len, sample_format_silence(w->format), chunk * frame_bytes);
+        w->buf_len += chunk * frame_bytes;
+        frames -= chunk;
+    }
+    return 0;
+}
+
+// Appends float32 frames copied straight from another file, letting the
+// kernel move the bytes where copy_file_range() is available
+static int wav_writer_copy_range(WavWriter *w, int in_fd, off_t offset, size_t frames) {
+    size_t remaining = frames * w->channels * sizeof(float);
+    int ret;
+    
+    if ((ret = wav_writer_flush(w)) < 0) return ret;
+    if (w->io && (ret = io_completion_wait(&w->writes, 0)) < 0) return ret;
+    w->frames_written += frames;
+    
+#ifdef __linux__
+    while (remaining > 0) {
+        loff_t out_offset = w->offset;
+        ssize_t n = copy_file_range(in_fd, &offset, w->fd, &out_offset, remaining, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        w->offset += n;
+        remaining -= n;
+    }
+#endif
+    
+    // Fallback for other platforms and filesystems that refuse the copy
+    while (remaining > 0) {
+        size_t chunk = remaining < WAV_WRITER_BUF_SIZE ? remaining : WAV_WRITER_BUF_SIZE;
+        ssize_t n = pread(in_fd, w->buf, chunk, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return AVERROR(errno);
+        if (n == 0) return AVERROR_EOF;
+        if ((ret = pwrite_all(w->fd, w->buf, n, w->offset)) < 0) return ret;
+        w->offset += n;
+        offset += n;
+        remaining -= n;
+    }
+    return 0;
+}
+
+static int wav_writer_close(WavWriter *w) {
     int ret = 0;
-    int stream_index = -1;
     
-    // Open input
-    ret = avformat_open_input(&in_fmt_ctx, input_path, NULL, NULL);
-    if (ret < 0) goto cleanup;
+    if (w->encoder) {
+        ret = output_encoder_close(w->encoder);
+        w->encoder = NULL;
+    } else if (w->fd >= 0 && w->shared) {
+        ret = wav_writer_flush(w);
+        w->fd = -1;
+    } else if (w->fd >= 0) {
+        ret = wav_writer_flush(w);
+        if (w->io) {
+            int err = io_completion_wait(&w->writes, 0);
+            if (ret == 0) ret = err;
+        }
+        if (ret == 0) {
+            uint8_t header[WAV_HEADER_MAX_SIZE];
+            int len = wav_build_header(header, w->sample_rate, w->channels, w->format, w->frames_written);
+            ret = pwrite_all(w->fd, header, len, 0);
+        }
+        if (close(w->fd) != 0 && ret == 0) ret = AVERROR(errno);
+        w->fd = -1;
+    }
+    if (w->io) {
+        io_completion_destroy(&w->writes);
+        w->io = NULL;
+    }
+    if (w->mel) {
+        mel_extractor_free(w->mel);
+        free(w->mel);
+        w->mel = NULL;
+    }
+    free(w->buf);
+    w->buf = NULL;
+    return ret;
+}
+
+// Packed output (--pack, --tar-shards): instead of one WAV per input, every
+// worker appends its outputs to a shard file of its own, so writers never
+// contend and a run leaves a handful of large files. A shard's end only
+// advances when an output is committed; the bytes of a failed file are
+// overwritten by the next one.
+//
+// --pack shards hold raw interleaved float32 samples. At the end all
+// records are written to index.bin, sorted by key (the input path relative
+// to the input directory) so readers can mmap it and binary search:
+//
+//   PackIndexHeader, entry_count PackIndexEntry records, then the keys,
+//   each followed by a NUL. Integers are in host byte order, little-endian
+//   on every supported platform.
+//
+// --tar-shards writes WebDataset-style tar archives instead: one "<key>.wav"
+// member per input, with a new archive once a shard passes the size limit.
+#define PACK_INDEX_NAME "index.bin"
+#define PACK_INDEX_MAGIC "APPACK"
+#define PACK_INDEX_VERSION 1
+#define TAR_BLOCK 512
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t shard_count;       // shard-00000.f32 and up, next to the index
+    uint64_t entry_count;
+    uint64_t entries_offset;
+    uint64_t keys_offset;
+} PackIndexHeader;
+
+typedef struct {
+    uint64_t key_offset;        // relative to keys_offset
+    uint32_t key_len;
+    uint32_t shard;
+    uint64_t offset;            // bytes into the shard
+    uint64_t frames;
+    uint32_t channels;
+    uint32_t sample_rate;
+} PackIndexEntry;
+
+typedef struct {
+    char *key;
+    PackIndexEntry entry;
+} PackRecord;
+
+typedef struct {
+    int fd;
+    // End of the committed outputs. Only the owning worker touches the
+    // shard until pack_close().
+    uint64_t size;
+    PackRecord *records;
+    size_t count;
+    size_t capacity;
+    long packed;                // outputs committed
+    // Tar mode: number of the open archive and the members written to it
+    int seq;
+    int members;
+} PackShard;
+
+typedef struct {
+    int enabled;
+    const char *output_dir;
+    size_t key_prefix;          // length of "<input_dir>/"
+    uint64_t tar_limit;         // rollover size of tar shards, 0 for --pack
+    int shard_count;
+    PackShard *shards;
+    atomic_int files;           // shard files created
+} PackOutput;
+
+static PackOutput pack_output;
+
+static int pack_shard_open(int worker) {
+    PackShard *shard = &pack_output.shards[worker];
+    char path[4096];
+    if (pack_output.tar_limit) {
+        snprintf(path, sizeof(path), "%s/shard-%03d-%05d.tar", pack_output.output_dir, worker, shard->seq);
+    } else {
+        snprintf(path, sizeof(path), "%s/shard-%05d.f32", pack_output.output_dir, worker);
+    }
     
-    ret = avformat_find_stream_info(in_fmt_ctx, NULL);
-    if (ret < 0) goto cleanup;
+    shard->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (shard->fd < 0) return AVERROR(errno);
+    shard->size = 0;
+    shard->members = 0;
+    atomic_fetch_add(&pack_output.files, 1);
+    return 0;
+}
+
+// Ends the shard's archive with the two zero blocks tar requires and trims
+// whatever a failed output left behind. An archive without members is
+// removed again.
+static int pack_shard_close(int worker) {
+    PackShard *shard = &pack_output.shards[worker];
+    int ret = 0;
+    if (shard->fd < 0) return 0;
     
-    // Find audio stream
-    stream_index = av_find_best_stream(in_fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
-    if (stream_index < 0) { ret = stream_index; goto cleanup; }
+    if (pack_output.tar_limit && shard->members == 0) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/shard-%03d-%05d.tar", pack_output.output_dir, worker, shard->seq);
+        unlink(path);
+        atomic_fetch_sub(&pack_output.files, 1);
+        close(shard->fd);
+        shard->fd = -1;
+        return 0;
+    }
     
-    AVStream *in_stream = in_fmt_ctx->streams[stream_index];
-    const AVCodec *decoder = avcodec_find_decoder(in_stream->codecpar->codec_id);
-    if (!decoder) { ret = -1; goto cleanup; }
+    if (pack_output.tar_limit) {
+        static const uint8_t zeros[2 * TAR_BLOCK];
+        ret = pwrite_all(shard->fd, zeros, sizeof(zeros), shard->size);
+        shard->size += sizeof(zeros);
+    }
+    if (ret == 0 && (ftruncate(shard->fd, shard->size) != 0 || fsync(shard->fd) != 0)) ret = AVERROR(errno);
+    close(shard->fd);
+    shard->fd = -1;
+    return ret;
+}
+
+static int pack_open(const char *output_dir, const char *input_dir, int shard_count, uint64_t tar_limit) {
+    pack_output.shards = calloc(shard_count, sizeof(PackShard));
+    if (!pack_output.shards) return AVERROR(ENOMEM);
+    pack_output.output_dir = output_dir;
+    pack_output.key_prefix = strlen(input_dir) + 1;
+    pack_output.tar_limit = tar_limit;
+    pack_output.shard_count = shard_count;
+    atomic_init(&pack_output.files, 0);
+    pack_output.enabled = 1;
+    
+    for (int i = 0; i < shard_count; i++) {
+        int ret = pack_shard_open(i);
+        if (ret < 0) return ret;
+    }
+    return 0;
+}
+
+// Fills in a ustar header. Names over 100 bytes are split into prefix and
+// name at a slash; returns 0 when that is not possible.
+static int tar_build_header(uint8_t *h, const char *name, uint64_t size) {
+    size_t len = strlen(name);
+    const char *base = name;
     
-    dec_ctx = avcodec_alloc_context3(decoder);
-    if (!dec_ctx) { ret = -1; goto cleanup; }
+    memset(h, 0, TAR_BLOCK);
+    if (len > 100) {
+        base = strchr(name + len - 100 - 1, '/');
+        if (!base || base - name > 155) return 0;
+        memcpy(h + 345, name, base - name);
+        base++;
+    }
+    memcpy(h, base, strlen(base));
+    snprintf((char *)h + 100, 8, "%07o", 0644);
+    snprintf((char *)h + 108, 8, "%07o", 0);
+    snprintf((char *)h + 116, 8, "%07o", 0);
+    snprintf((char *)h + 124, 12, "%011" PRIo64, size);
+    snprintf((char *)h + 136, 12, "%011lo", (unsigned long)time(NULL));
+    h[156] = '0';
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
     
-    ret = avcodec_parameters_to_context(dec_ctx, in_stream->codecpar);
-    if (ret < 0) goto cleanup;
+    // The checksum is computed with its own field set to spaces
+    unsigned sum = 0;
+    memset(h + 148, ' ', 8);
+    for (int i = 0; i < TAR_BLOCK; i++) sum += h[i];
+    snprintf((char *)h + 148, 8, "%06o", sum);
+    return 1;
+}
+
+// Writes the WAV and tar headers around the samples of a finished output.
+// WebDataset splits the sample key from the extension at the first dot of
+// the file name, so dots in the input's name become underscores.
+static int pack_commit_tar(PackShard *shard, const char *key, const WavWriter *w) {
+    uint8_t header[TAR_BLOCK];
+    char name[4096];
     
-    ret = avcodec_open2(dec_ctx, decoder, NULL);
-    if (ret < 0) goto cleanup;
+    const char *base = strrchr(key, '/');
+    base = base ? base + 1 : key;
+    const char *ext = strrchr(base, '.');
+    size_t stem = ext && ext != base ? (size_t)(ext - key) : strlen(key);
+    if (stem + sizeof(".wav") > sizeof(name)) return AVERROR(ENAMETOOLONG);
+    memcpy(name, key, stem);
+    strcpy(name + stem, ".wav");
+    for (char *p = name + (base - key); p < name + stem; p++) {
+        if (*p == '.') *p = '_';
+    }
     
-    int in_sample_rate = dec_ctx->sample_rate;
-    int channels = dec_ctx->ch_layout.nb_channels;
-    if (channels == 0) channels = 2;
+    uint64_t data_size = w->offset - shard->size - TAR_BLOCK;
+    if (!tar_build_header(header, name, data_size)) return AVERROR(ENAMETOOLONG);
+    
+    uint8_t wav_header[WAV_HEADER_MAX_SIZE];
+    int len = wav_build_header(wav_header, w->sample_rate, w->channels, w->format, w->frames_written);
+    int ret = pwrite_all(shard->fd, wav_header, len, shard->size + TAR_BLOCK);
+    if (ret == 0) ret = pwrite_all(shard->fd, header, sizeof(header), shard->size);
+    
+    // Pad the member to a whole block
+    static const uint8_t zeros[TAR_BLOCK];
+    size_t pad = (TAR_BLOCK - data_size % TAR_BLOCK) % TAR_BLOCK;
+    if (ret == 0) ret = pwrite_all(shard->fd, zeros, pad, w->offset);
+    if (ret < 0) return ret;
+    
+    shard->size = w->offset + pad;
+    shard->members++;
+    shard->packed++;
+    return 0;
+}
+
+// Records the output a worker just finished in its shard and moves the
+// shard's end past it
+static int pack_commit(int worker, const ProcessTask *task, const WavWriter *w) {
+    PackShard *shard = &pack_output.shards[worker];
+    const char *key = task->input_path + pack_output.key_prefix;
+    if (pack_output.tar_limit) return pack_commit_tar(shard, key, w);
+    
+    if (shard->count >= shard->capacity) {
+        size_t capacity = shard->capacity ? shard->capacity * 2 : 1024;
+        PackRecord *records = realloc(shard->records, capacity * sizeof(PackRecord));
+        if (!records) return AVERROR(ENOMEM);
+        shard->records = records;
+        shard->capacity = capacity;
+    }
+    
+    PackRecord *r = &shard->records[shard->count];
+    r->key = strdup(key);
+    if (!r->key) return AVERROR(ENOMEM);
+    r->entry = (PackIndexEntry){
+        .key_len = strlen(r->key),
+        .shard = worker,
+        .offset = shard->size,
+        .frames = w->frames_written,
+        .channels = w->channels,
+        .sample_rate = w->sample_rate
+    };
+    shard->count++;
+    shard->packed++;
+    shard->size = w->offset;
+    return 0;
+}
+
+static int compare_pack_record(const void *a, const void *b) {
+    return strcmp(((const PackRecord *)a)->key, ((const PackRecord *)b)->key);
+}
+
+// Closes the shards and, for --pack, writes the sorted index. Returns the
+// number of packed files.
+static long pack_close(void) {
+    long ret = 0;
+    long packed = 0;
+    size_t total = 0;
+    PackRecord *all = NULL;
+    char *path = NULL, *tmp_path = NULL;
+    FILE *f = NULL;
+    
+    for (int i = 0; i < pack_output.shard_count; i++) {
+        int err = pack_shard_close(i);
+        if (err < 0) ret = err;
+        total += pack_output.shards[i].count;
+        packed += pack_output.shards[i].packed;
+    }
+    if (pack_output.tar_limit) goto done;
+    
+    all = malloc((total ? total : 1) * sizeof(PackRecord));
+    if (!all || asprintf(&path, "%s/%s", pack_output.output_dir, PACK_INDEX_NAME) < 0 ||
+        asprintf(&tmp_path, "%s.tmp", path) < 0) {
+        ret = AVERROR(ENOMEM);
+        goto done;
+    }
+    
+    size_t n = 0;
+    for (int i = 0; i < pack_output.shard_count; i++) {
+        memcpy(all + n, pack_output.shards[i].records, pack_output.shards[i].count * sizeof(PackRecord));
+        n += pack_output.shards[i].count;
+    }
+    qsort(all, total, sizeof(PackRecord), compare_pack_record);
+    
+    PackIndexHeader header = {
+        .version = PACK_INDEX_VERSION,
+        .shard_count = pack_output.shard_count,
+        .entry_count = total,
+        .entries_offset = sizeof(PackIndexHeader),
+        .keys_offset = sizeof(PackIndexHeader) + total * sizeof(PackIndexEntry)
+    };
+    memcpy(header.magic, PACK_INDEX_MAGIC, sizeof(PACK_INDEX_MAGIC));
+    
+    f = fopen(tmp_path, "wb");
+    if (!f) {
+        ret = AVERROR(errno);
+        goto done;
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    uint64_t key_offset = 0;
+    for (size_t i = 0; i < total; i++) {
+        all[i].entry.key_offset = key_offset;
+        key_offset += all[i].entry.key_len + 1;
+        fwrite(&all[i].entry, sizeof(PackIndexEntry), 1, f);
+    }
+    for (size_t i = 0; i < total; i++) fwrite(all[i].key, all[i].entry.key_len + 1, 1, f);
+    
+    if (ferror(f) || fflush(f) != 0 || fsync(fileno(f)) != 0) ret = AVERROR(EIO);
+    if (fclose(f) != 0 && ret == 0) ret = AVERROR(errno);
+    if (ret == 0 && rename(tmp_path, path) != 0) ret = AVERROR(errno);
+    if (ret < 0) unlink(tmp_path);
+
+done:
+    for (int i = 0; i < pack_output.shard_count; i++) {
+        for (size_t k = 0; k < pack_output.shards[i].count; k++) free(pack_output.shards[i].records[k].key);
+        free(pack_output.shards[i].records);
+    }
+    free(pack_output.shards);
+    free(all);
+    free(path);
+    free(tmp_path);
+    return ret < 0 ? ret : packed;
+}
+
+// Fixed-length array output (--npy): every clip becomes one row of
+// data.npy, shaped (files, channels, frames) with frames the padded
+// maximum length, so loaders can np.load(mmap_mode='r') it. Rows follow the
+// sorted input paths listed in data.keys; lengths.npy holds the frames a
+// WAV output would have had, 0 for files that failed. Workers write
+// straight into their row, which stays interleaved until the commit
+// rewrites it channel by channel.
+#define NPY_DATA_NAME "data.npy"
+#define NPY_KEYS_NAME "data.keys"
+#define NPY_LENGTHS_NAME "lengths.npy"
+
+typedef struct {
+    int enabled;
+    int fd;
+    const char *output_dir;
+    int channels;
+    uint64_t frames;
+    uint64_t data_offset;       // size of the .npy header
+    int rows;
+    int64_t *lengths;
+} NpyOutput;
+
+static NpyOutput npy_output;
+
+// Writes a version 1.0 .npy header, padded so the data starts 64-byte
+// aligned. Returns the header size.
+static int npy_write_header(int fd, const char *descr, const char *shape) {
+    char dict[256];
+    int len = snprintf(dict, sizeof(dict), "{'descr': '%s', 'fortran_order': False, 'shape': %s, }",
+                       descr, shape);
+    int total = (10 + len + 1 + 63) / 64 * 64;
+    
+    uint8_t header[320];
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    put_le16(header + 8, total - 10);
+    memcpy(header + 10, dict, len);
+    memset(header + 10 + len, ' ', total - 10 - len - 1);
+    header[total - 1] = '\n';
+    
+    int ret = pwrite_all(fd, header, total, 0);
+    return ret < 0 ? ret : total;
+}
+
+static int compare_task_path(const void *a, const void *b) {
+    return strcmp(((const ProcessTask *)a)->input_path, ((const ProcessTask *)b)->input_path);
+}
+
+// Numbers the tasks in path order and preallocates the array. The tasks
+// may be reordered afterwards; each keeps its row.
+static int npy_open(const char *output_dir, const char *input_dir, ProcessTask *tasks, int count,
+                    int channels, uint64_t frames) {
+    char path[4096];
+    int ret = 0;
+    
+    qsort(tasks, count, sizeof(ProcessTask), compare_task_path);
+    
+    snprintf(path, sizeof(path), "%s/%s", output_dir, NPY_KEYS_NAME);
+    FILE *f = fopen(path, "w");
+    if (!f) return AVERROR(errno);
+    size_t prefix = strlen(input_dir) + 1;
+    for (int i = 0; i < count; i++) {
+        tasks[i].row = i;
+        fprintf(f, "%s\n", tasks[i].input_path + prefix);
+    }
+    if (ferror(f)) ret = AVERROR(EIO);
+    if (fclose(f) != 0 && ret == 0) ret = AVERROR(errno);
+    if (ret < 0) return ret;
+    
+    npy_output.lengths = calloc(count ? count : 1, sizeof(int64_t));
+    if (!npy_output.lengths) return AVERROR(ENOMEM);
+    
+    snprintf(path, sizeof(path), "%s/%s", output_dir, NPY_DATA_NAME);
+    npy_output.fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (npy_output.fd < 0) return AVERROR(errno);
+    
+    char shape[96];
+    snprintf(shape, sizeof(shape), "(%d, %d, %" PRIu64 ")", count, channels, frames);
+    ret = npy_write_header(npy_output.fd, "<f4", shape);
+    if (ret < 0) return ret;
+    
+    // Leave the array sparse: unwritten samples read back as zero padding
+    npy_output.data_offset = ret;
+    if (ftruncate(npy_output.fd, ret + (uint64_t)count * channels * frames * sizeof(float)) != 0) {
+        return AVERROR(errno);
+    }
+    
+    npy_output.output_dir = output_dir;
+    npy_output.channels = channels;
+    npy_output.frames = frames;
+    npy_output.rows = count;
+    npy_output.enabled = 1;
+    return 0;
+}
+
+static uint64_t npy_row_offset(long row) {
+    return npy_output.data_offset + (uint64_t)row * npy_output.channels * npy_output.frames * sizeof(float);
+}
+
+// Rewrites a finished row from interleaved to channel-major order and
+// records its length
+static int npy_commit(const ProcessTask *task, const WavWriter *w) {
+    int channels = npy_output.channels;
+    
+    if (channels > 1) {
+        size_t row_size = channels * npy_output.frames * sizeof(float);
+        float *in = malloc(w->frames_written * channels * sizeof(float));
+        float *out = calloc(1, row_size);
+        int ret = in && out ? 0 : AVERROR(ENOMEM);
+        
+        if (ret == 0) {
+            ssize_t n = pread(npy_output.fd, in, w->frames_written * channels * sizeof(float),
+                              npy_row_offset(task->row));
+            if (n != (ssize_t)(w->frames_written * channels * sizeof(float))) ret = AVERROR(EIO);
+        }
+        if (ret == 0) {
+            for (uint64_t i = 0; i < w->frames_written; i++) {
+                for (int c = 0; c < channels; c++) out[c * npy_output.frames + i] = in[i * channels + c];
+            }
+            ret = pwrite_all(npy_output.fd, out, row_size, npy_row_offset(task->row));
+        }
+        free(in);
+        free(out);
+        if (ret < 0) return ret;
+    }
+    
+    npy_output.lengths[task->row] = w->frames_written;
+    return 0;
+}
+
+// Syncs the array and writes lengths.npy. Returns the number of rows filled.
+static long npy_close(void) {
+    long ret = 0;
+    long filled = 0;
+    char path[4096], shape[32];
+    
+    if (fsync(npy_output.fd) != 0) ret = AVERROR(errno);
+    close(npy_output.fd);
+    
+    snprintf(path, sizeof(path), "%s/%s", npy_output.output_dir, NPY_LENGTHS_NAME);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ret = AVERROR(errno);
+    } else {
+        snprintf(shape, sizeof(shape), "(%d,)", npy_output.rows);
+        int header = npy_write_header(fd, "<i8", shape);
+        int err = header < 0 ? header :
+            pwrite_all(fd, npy_output.lengths, npy_output.rows * sizeof(int64_t), header);
+        if (err == 0 && fsync(fd) != 0) err = AVERROR(errno);
+        if (err < 0) ret = err;
+        close(fd);
+    }
+    
+    for (int i = 0; i < npy_output.rows; i++) filled += npy_output.lengths[i] > 0;
+    free(npy_output.lengths);
+    return ret < 0 ? ret : filled;
+}
+
+// Per-file feature statistics (--stats): the extractor summarises every
+// output while it is written, and the rows collected here are written on
+// close as one .npy per column in stats/, sorted by input path and listed
+// in stats/keys, so QA loads just the columns it needs without decoding
+// the corpus again.
+#define STATS_DIR_NAME "stats"
+#define STATS_KEYS_NAME "keys"
+
+typedef struct {
+    char *key;
+    int64_t frames;
+    float *values;              // mel_extractor_summary() layout
+} StatsRow;
+
+static struct {
+    pthread_mutex_t mutex;
+    int enabled;
+    const char *output_dir;
+    size_t key_prefix;
+    int n_mfcc;
+    StatsRow *rows;
+    size_t count;
+    size_t capacity;
+} stats_output = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// Columns as (name, values per row, offset into the summary)
+typedef struct {
+    const char *name;
+    int width;
+    int offset;
+} StatsColumn;
+
+static void stats_open(const char *output_dir, const char *input_dir, int n_mfcc) {
+    stats_output.output_dir = output_dir;
+    stats_output.key_prefix = strlen(input_dir) + 1;
+    stats_output.n_mfcc = n_mfcc;
+    stats_output.enabled = 1;
+}
+
+static int stats_commit(const ProcessTask *task, const WavWriter *w, const MelExtractor *mel) {
+    StatsRow row = {
+        .key = strdup(task->input_path + stats_output.key_prefix),
+        .frames = w->frames_written,
+        .values = malloc(mel_summary_size(mel->tables) * sizeof(float))
+    };
+    if (!row.key || !row.values) goto fail;
+    mel_extractor_summary(mel, row.values);
+    
+    pthread_mutex_lock(&stats_output.mutex);
+    if (stats_output.count >= stats_output.capacity) {
+        size_t capacity = stats_output.capacity ? stats_output.capacity * 2 : 1024;
+        StatsRow *rows = realloc(stats_output.rows, capacity * sizeof(StatsRow));
+        if (!rows) {
+            pthread_mutex_unlock(&stats_output.mutex);
+            goto fail;
+        }
+        stats_output.rows = rows;
+        stats_output.capacity = capacity;
+    }
+    stats_output.rows[stats_output.count++] = row;
+    pthread_mutex_unlock(&stats_output.mutex);
+    return 0;
+
+fail:
+    free(row.key);
+    free(row.values);
+    return AVERROR(ENOMEM);
+}
+
+static int compare_stats_row(const void *a, const void *b) {
+    return strcmp(((const StatsRow *)a)->key, ((const StatsRow *)b)->key);
+}
+
+// Writes one column of every row as a float32 .npy
+static int stats_write_column(const char *dir, const StatsColumn *column, float *buf) {
+    char path[4096 + 64], shape[64];
+    size_t count = stats_output.count;
+    
+    for (size_t i = 0; i < count; i++) {
+        memcpy(buf + i * column->width, stats_output.rows[i].values + column->offset,
+               column->width * sizeof(float));
+    }
+    if (column->width == 1) snprintf(shape, sizeof(shape), "(%zu,)", count);
+    else snprintf(shape, sizeof(shape), "(%zu, %d)", count, column->width);
+    
+    snprintf(path, sizeof(path), "%s/%s.npy", dir, column->name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return AVERROR(errno);
+    int header = npy_write_header(fd, "<f4", shape);
+    int ret = header < 0 ? header : pwrite_all(fd, buf, count * column->width * sizeof(float), header);
+    if (close(fd) != 0 && ret == 0) ret = AVERROR(errno);
+    return ret;
+}
+
+// Writes the sorted keys, frames.npy and the statistic columns. Returns
+// the number of rows.
+static long stats_close(void) {
+    int n_mfcc = stats_output.n_mfcc;
+    const StatsColumn columns[] = {
+        {"rms_mean", 1, MEL_STAT_RMS_MEAN},
+        {"rms_max", 1, MEL_STAT_RMS_MAX},
+        {"zcr_mean", 1, MEL_STAT_ZCR_MEAN},
+        {"centroid_mean", 1, MEL_STAT_CENTROID_MEAN},
+        {"mfcc_mean", n_mfcc, MEL_STAT_MFCC},
+        {"mfcc_std", n_mfcc, MEL_STAT_MFCC + n_mfcc}
+    };
+    size_t count = stats_output.count;
+    char dir[4096], path[4096 + 64], shape[32];
+    long ret = 0;
+    float *buf = NULL;
+    int64_t *frames = NULL;
+    
+    snprintf(dir, sizeof(dir), "%s/%s", stats_output.output_dir, STATS_DIR_NAME);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        ret = AVERROR(errno);
+        goto done;
+    }
+    qsort(stats_output.rows, count, sizeof(StatsRow), compare_stats_row);
+    
+    snprintf(path, sizeof(path), "%s/%s", dir, STATS_KEYS_NAME);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        ret = AVERROR(errno);
+        goto done;
+    }
+    for (size_t i = 0; i < count; i++) fprintf(f, "%s\n", stats_output.rows[i].key);
+    if (ferror(f)) ret = AVERROR(EIO);
+    if (fclose(f) != 0 && ret == 0) ret = AVERROR(errno);
+    if (ret < 0) goto done;
+    
+    frames = malloc((count + 1) * sizeof(int64_t));
+    buf = malloc((count * (n_mfcc > 1 ? n_mfcc : 1) + 1) * sizeof(float));
+    if (!frames || !buf) {
+        ret = AVERROR(ENOMEM);
+        goto done;
+    }
+    for (size_t i = 0; i < count; i++) frames[i] = stats_output.rows[i].frames;
+    snprintf(path, sizeof(path), "%s/frames.npy", dir);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ret = AVERROR(errno);
+        goto done;
+    }
+    snprintf(shape, sizeof(shape), "(%zu,)", count);
+    int header = npy_write_header(fd, "<i8", shape);
+    ret = header < 0 ? header : pwrite_all(fd, frames, count * sizeof(int64_t), header);
+    if (close(fd) != 0 && ret == 0) ret = AVERROR(errno);
+    
+    for (size_t c = 0; ret == 0 && c < sizeof(columns) / sizeof(columns[0]); c++) {
+        if (columns[c].width > 0) ret = stats_write_column(dir, &columns[c], buf);
+    }
+
+done:
+    for (size_t i = 0; i < count; i++) {
+        free(stats_output.rows[i].key);
+        free(stats_output.rows[i].values);
+    }
+    free(stats_output.rows);
+    free(frames);
+    free(buf);
+    return ret < 0 ? ret : (long)count;
+}
+
+// Opens the audio output of a task: its part file, its row of the array,
+// or in packed mode the end of the worker's shard, rolling over to a new
+// tar archive when it is full
+static int output_open_audio(WavWriter *w, ProcessTask *task, int worker, int sample_rate, int channels,
+                             IoEngine *io) {
+    if (npy_output.enabled) {
+        if (channels != npy_output.channels) {
+            fprintf(stderr, "%s has %d channels, the array has %d\n", task->input_path, channels,
+                    npy_output.channels);
+            return AVERROR(EINVAL);
+        }
+        return wav_writer_open_at(w, npy_output.fd, sample_rate, channels, SAMPLE_FORMAT_F32,
+                                  npy_row_offset(task->row));
+    }
+    if (pack_output.enabled) {
+        PackShard *shard = &pack_output.shards[worker];
+        uint64_t offset = shard->size;
+        if (pack_output.tar_limit) {
+            if (shard->size >= pack_output.tar_limit) {
+                int ret = pack_shard_close(worker);
+                shard->seq++;
+                if (ret == 0) ret = pack_shard_open(worker);
+                if (ret < 0) return ret;
+            }
+            // Room for the tar and WAV headers, written on commit
+            offset = shard->size + TAR_BLOCK + wav_header_size(task->config.sample_format);
+        }
+        return wav_writer_open_at(w, shard->fd, sample_rate, channels, task->config.sample_format, offset);
+    }
+    if (task->config.codec != OUTPUT_WAV) {
+        return wav_writer_open_encoded(w, task->part_path, sample_rate, channels, &task->config);
+    }
+    return wav_writer_open(w, task->part_path, sample_rate, channels, task->config.sample_format, io);
+}
+
+static int output_open(WavWriter *w, ProcessTask *task, int worker, int sample_rate, int channels,
+                       IoEngine *io) {
+    int ret = task->config.features == FEATURES_ONLY ? wav_writer_open_discard(w, sample_rate, channels) :
+        output_open_audio(w, task, worker, sample_rate, channels, io);
+    if (ret == 0 && (task->config.features || task->config.stats)) ret = wav_writer_attach_mel(w, &task->config);
+    return ret;
+}
+
+// Path of the features written next to an audio output (--mel)
+static char *mel_sidecar_path(const char *output_path) {
+    char *path;
+    const char *dot = strrchr(output_path, '.');
+    int stem_len = dot ? (int)(dot - output_path) : (int)strlen(output_path);
+    if (asprintf(&path, "%.*s%s", stem_len, output_path, MEL_EXTENSION) < 0) return NULL;
+    return path;
+}
+
+// Writes the log-mel features of a finished output as a (frames, n_mels)
+// float32 .npy: to the part file when they replace the audio, otherwise
+// next to it through a temporary name
+static int mel_output_write(const ProcessTask *task, const MelExtractor *mel) {
+    char *path = NULL, *tmp_path = NULL;
+    int ret = 0;
+    
+    if (task->config.features == FEATURES_ONLY) {
+        path = strdup(task->part_path);
+    } else {
+        path = mel_sidecar_path(task->output_path);
+        if (path && asprintf(&tmp_path, "%s.part", path) < 0) tmp_path = NULL;
+        if (!tmp_path) ret = AVERROR(ENOMEM);
+    }
+    if (!path) ret = AVERROR(ENOMEM);
+    if (ret < 0) goto done;
+    
+    const char *target = tmp_path ? tmp_path : path;
+    int fd = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ret = AVERROR(errno);
+        goto done;
+    }
+    
+    int n_mels = mel_tables_n_mels(mel->tables);
+    char shape[64];
+    snprintf(shape, sizeof(shape), "(%zu, %d)", mel->frames, n_mels);
+    int header = npy_write_header(fd, "<f4", shape);
+    ret = header < 0 ? header : pwrite_all(fd, mel->out, mel->frames * n_mels * sizeof(float), header);
+    if (close(fd) != 0 && ret == 0) ret = AVERROR(errno);
+    if (ret == 0 && tmp_path && rename(tmp_path, path) != 0) ret = AVERROR(errno);
+    if (ret < 0 && tmp_path) unlink(tmp_path);
+
+done:
+    free(path);
+    free(tmp_path);
+    return ret;
+}
+
+static int output_close(WavWriter *w, const ProcessTask *task, int worker) {
+    // The features and statistics are written once the audio is complete
+    MelExtractor *mel = w->mel;
+    w->mel = NULL;
+    
+    int ret = wav_writer_close(w);
+    if (ret == 0 && pack_output.enabled) ret = pack_commit(worker, task, w);
+    if (ret == 0 && npy_output.enabled) ret = npy_commit(task, w);
+    if (ret == 0 && mel && task->config.features) ret = mel_output_write(task, mel);
+    if (ret == 0 && mel && task->config.stats) ret = stats_commit(task, w, mel);
+    if (mel) {
+        mel_extractor_free(mel);
+        free(mel);
+    }
+    return ret;
+}
+
+// File handed to FFmpeg through a custom AVIOContext. The first `loaded`
+// bytes are already in memory; the rest, if any, is read through fd.
+typedef struct {
+    const uint8_t *data;
+    size_t loaded;
+    size_t size;
+    size_t pos;
+    int fd;
+} MemoryInput;
+
+static int memory_input_read(void *opaque, uint8_t *buf, int buf_size) {
+    MemoryInput *mem = opaque;
+    size_t avail = mem->size - mem->pos;
+    
+    if (avail == 0) return AVERROR_EOF;
+    if ((size_t)buf_size > avail) buf_size = avail;
+    
+    if (mem->pos < mem->loaded) {
+        if ((size_t)buf_size > mem->loaded - mem->pos) buf_size = mem->loaded - mem->pos;
+        memcpy(buf, mem->data + mem->pos, buf_size);
+    } else {
+        ssize_t n = mem->fd >= 0 ? pread(mem->fd, buf, buf_size, mem->pos) : 0;
+        if (n < 0) return AVERROR(errno);
+        if (n == 0) return AVERROR_EOF;
+        buf_size = n;
+    }
+    mem->pos += buf_size;
+    return buf_size;
+}
+
+static int64_t memory_input_seek(void *opaque, int64_t offset, int whence) {
+    MemoryInput *mem = opaque;
+    
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE: return mem->size;
+    case SEEK_SET: break;
+    case SEEK_CUR: offset += mem->pos; break;
+    case SEEK_END: offset += mem->size; break;
+    default: return AVERROR(EINVAL);
+    }
+    
+    if (offset < 0 || (uint64_t)offset > mem->size) return AVERROR(EINVAL);
+    mem->pos = offset;
+    return offset;
+}
+
+#define INPUT_AVIO_BUF_SIZE (64 * 1024)
+#define INPUT_PREFETCH_MIN (1024 * 1024)
+
+#define INPUT_PREFETCH_MAX (64 * 1024 * 1024)
+
+// Where the demuxer reads from: FFmpeg's own file protocol, a memory
+// mapping of the input, or a buffer filled ahead of time by the I/O engine.
+// The latter two are exposed through a custom AVIOContext.
+typedef struct {
+    uint8_t *map;
+    size_t map_size;
+    IoEngine *io;
+    IoPrefetch *prefetch;
+    MemoryInput mem;
+    AVIOContext *avio;
+} InputSource;
+
+static void input_source_close(InputSource *src, AVFormatContext **fmt_ctx) {
+    if (*fmt_ctx) avformat_close_input(fmt_ctx);
+    if (src->avio) {
+        av_freep(&src->avio->buffer);
+        avio_context_free(&src->avio);
+    }
+    if (src->map) munmap(src->map, src->map_size);
+    if (src->prefetch) io_prefetch_release(src->io, src->prefetch);
+    memset(src, 0, sizeof(*src));
+}
+
+// Takes ownership of the prefetch, if there is one
+static int input_source_open(InputSource *src, const char *path, const ProcessorConfig *config,
+                             IoPrefetch *prefetch, IoEngine *io, AVFormatContext **fmt_ctx) {
+    memset(src, 0, sizeof(*src));
+    src->io = io;
+    src->prefetch = prefetch;
+    
+    if (src->prefetch && io_prefetch_wait(src->prefetch) == 0) {
+        IoPrefetch *p = src->prefetch;
+        src->mem = (MemoryInput){
+            .data = p->data, .loaded = p->loaded, .size = p->file_size, .fd = p->fd
+        };
+    } else if (config->use_mmap) {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                src->map = map;
+                src->map_size = st.st_size;
+            }
+        }
+        if (fd >= 0) close(fd);
+        
+        if (src->map) {
+            // Only the headers are needed until the stream duration is known
+            size_t head = src->map_size < INPUT_PREFETCH_MIN ? src->map_size : INPUT_PREFETCH_MIN;
+            madvise(src->map, src->map_size, MADV_SEQUENTIAL);
+            madvise(src->map, head, MADV_WILLNEED);
+            
+            src->mem = (MemoryInput){
+                .data = src->map, .loaded = src->map_size, .size = src->map_size, .fd = -1
+            };
+        }
+    }
+    
+    // Empty files, failed mappings and failed prefetches use the file protocol
+    if (!src->mem.data && !src->mem.size) return avformat_open_input(fmt_ctx, path, NULL, NULL);
+    
+    uint8_t *avio_buf = av_malloc(INPUT_AVIO_BUF_SIZE);
+    if (!avio_buf) return AVERROR(ENOMEM);
+    
+    src->avio = avio_alloc_context(avio_buf, INPUT_AVIO_BUF_SIZE, 0, &src->mem,
+                                   memory_input_read, NULL, memory_input_seek);
+    if (!src->avio) {
+        av_free(avio_buf);
+        return AVERROR(ENOMEM);
+    }
+    
+    *fmt_ctx = avformat_alloc_context();
+    if (!*fmt_ctx) return AVERROR(ENOMEM);
+    (*fmt_ctx)->pb = src->avio;
+    
+    return avformat_open_input(fmt_ctx, path, NULL, NULL);
+}
+
+// Once the duration is known, fault in the part of the mapping that covers
+// max_duration_sec of audio and turn off readahead past it
+static void input_source_hint(InputSource *src, AVFormatContext *fmt_ctx, float max_duration_sec) {
+    if (!src->map || fmt_ctx->duration <= 0) return;
+    
+    double duration_sec = fmt_ctx->duration / (double)AV_TIME_BASE;
+    if (max_duration_sec >= duration_sec) {
+        madvise(src->map, src->map_size, MADV_WILLNEED);
+        return;
+    }
+    
+    // Proportional estimate with a margin for headers and bitrate variation
+    size_t needed = (size_t)(src->map_size * (max_duration_sec / duration_sec) * 1.1) + INPUT_PREFETCH_MIN;
+    if (needed >= src->map_size) {
+        madvise(src->map, src->map_size, MADV_WILLNEED);
+        return;
+    }
+    
+    long page = sysconf(_SC_PAGESIZE);
+    needed = (needed + page - 1) / page * page;
+    madvise(src->map, needed, MADV_WILLNEED);
+    madvise(src->map + needed, src->map_size - needed, MADV_RANDOM);
+}
+
+// Identifies a resampler configuration. Contexts with equal keys share the
+// same polyphase filter bank, so one can stand in for another after swr_init().
+typedef struct {
+    enum AVSampleFormat in_fmt;
+    int in_rate;
+    int out_rate;
+    int out_channels;
+    AVChannelLayout in_layout;
+} SwrKey;
+
+static int swr_key_equal(const SwrKey *a, const SwrKey *b) {
+    return a->in_fmt == b->in_fmt &&
+           a->in_rate == b->in_rate &&
+           a->out_rate == b->out_rate &&
+           a->out_channels == b->out_channels &&
+           av_channel_layout_compare(&a->in_layout, &b->in_layout) == 0;
+}
+
+// Process-wide pool of initialized resamplers, grouped by configuration.
+// libswresample cannot clone a context, so workers check idle contexts out
+// and hand them back when they move on to a file with different parameters.
+typedef struct SwrCacheEntry {
+    SwrKey key;
+    SwrContext **idle;
+    int idle_count;
+    int idle_capacity;
+    struct SwrCacheEntry *next;
+} SwrCacheEntry;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    SwrCacheEntry *entries;
+    atomic_ulong hits;
+    atomic_ulong misses;
+} SwrCache;
+
+static SwrCache swr_cache = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static SwrCacheEntry *swr_cache_find_locked(const SwrKey *key) {
+    for (SwrCacheEntry *e = swr_cache.entries; e; e = e->next) {
+        if (swr_key_equal(&e->key, key)) return e;
+    }
+    return NULL;
+}
+
+static SwrContext *swr_cache_acquire(const SwrKey *key) {
+    SwrContext *swr_ctx = NULL;
+    
+    pthread_mutex_lock(&swr_cache.mutex);
+    SwrCacheEntry *e = swr_cache_find_locked(key);
+    if (e && e->idle_count > 0) swr_ctx = e->idle[--e->idle_count];
+    pthread_mutex_unlock(&swr_cache.mutex);
+    
+    return swr_ctx;
+}
+
+static void swr_cache_release(const SwrKey *key, SwrContext *swr_ctx) {
+    pthread_mutex_lock(&swr_cache.mutex);
+    SwrCacheEntry *e = swr_cache_find_locked(key);
+    if (!e) {
+        e = calloc(1, sizeof(*e));
+        if (!e) goto fail;
+        e->key = *key;
+        e->key.in_layout = (AVChannelLayout){0};
+        av_channel_layout_copy(&e->key.in_layout, &key->in_layout);
+        e->next = swr_cache.entries;
+        swr_cache.entries = e;
+    }
+    if (e->idle_count >= e->idle_capacity) {
+        int capacity = e->idle_capacity ? e->idle_capacity * 2 : 4;
+        SwrContext **idle = realloc(e->idle, capacity * sizeof(*idle));
+        if (!idle) goto fail;
+        e->idle = idle;
+        e->idle_capacity = capacity;
+    }
+    e->idle[e->idle_count++] = swr_ctx;
+    pthread_mutex_unlock(&swr_cache.mutex);
+    return;
+
+fail:
+    pthread_mutex_unlock(&swr_cache.mutex);
+    swr_free(&swr_ctx);
+}
+
+static void swr_cache_destroy(void) {
+    SwrCacheEntry *e = swr_cache.entries;
+    while (e) {
+        SwrCacheEntry *next = e->next;
+        for (int i = 0; i < e->idle_count; i++) swr_free(&e->idle[i]);
+        free(e->idle);
+        av_channel_layout_uninit(&e->key.in_layout);
+        free(e);
+        e = next;
+    }
+    swr_cache.entries = NULL;
+}
+
+typedef enum {
+    RESAMPLE_SWR,
+    RESAMPLE_DECIMATE,
+    RESAMPLE_NONE
+} ResampleMode;
+
+// Decoder, resampler, frame and packet state owned by one worker thread.
+// It outlives individual tasks so consecutive files with the same stream
+// parameters only need a flush instead of a full teardown and rebuild.
+typedef struct {
+    AVCodecContext *dec_ctx;
+    AVCodecParameters *dec_par;
+    SwrContext *swr_ctx;
+    SwrKey swr_key;
+    Decimator decimator;
+    ResampleMode mode;
+    AVFrame *dec_frame;
+    AVPacket *pkt;
+    IoEngine *io;
+    // Where long files push their segments for other workers to steal
+    WorkScheduler *sched;
+    int worker;
+    int workers;
+} WorkerContext;
+
+static int worker_context_init(WorkerContext *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->dec_frame = av_frame_alloc();
+    ctx->pkt = av_packet_alloc();
+    if (!ctx->dec_frame || !ctx->pkt) return AVERROR(ENOMEM);
+    return 0;
+}
+
+// Drop the cached decoder and resampler, e.g. after a failed file left
+// them in an unknown state
+static void worker_context_reset(WorkerContext *ctx) {
+    if (ctx->dec_ctx) avcodec_free_context(&ctx->dec_ctx);
+    avcodec_parameters_free(&ctx->dec_par);
+    swr_free(&ctx->swr_ctx);
+    av_channel_layout_uninit(&ctx->swr_key.in_layout);
+    decimator_free(&ctx->decimator);
+    ctx->mode = RESAMPLE_SWR;
+}
+
+static void worker_context_free(WorkerContext *ctx) {
+    worker_context_reset(ctx);
+    av_packet_free(&ctx->pkt);
+    av_frame_free(&ctx->dec_frame);
+}
+
+static int codec_params_match(const AVCodecParameters *a, const AVCodecParameters *b) {
+    return a->codec_id == b->codec_id &&
+           a->format == b->format &&
+           a->sample_rate == b->sample_rate &&
+           a->block_align == b->block_align &&
+           a->bits_per_coded_sample == b->bits_per_coded_sample &&
+           av_channel_layout_compare(&a->ch_layout, &b->ch_layout) == 0 &&
+           a->extradata_size == b->extradata_size &&
+           (a->extradata_size == 0 || memcmp(a->extradata, b->extradata, a->extradata_size) == 0);
+}
+
+static int worker_context_prepare_decoder(WorkerContext *ctx, const AVCodecParameters *par) {
+    int ret;
+    
+    if (ctx->dec_ctx && codec_params_match(ctx->dec_par, par)) {
+        avcodec_flush_buffers(ctx->dec_ctx);
+        return 0;
+    }
+    
+    if (ctx->dec_ctx) avcodec_free_context(&ctx->dec_ctx);
+    avcodec_parameters_free(&ctx->dec_par);
+    
+    const AVCodec *decoder = avcodec_find_decoder(par->codec_id);
+    if (!decoder) return -1;
+    
+    ctx->dec_ctx = avcodec_alloc_context3(decoder);
+    ctx->dec_par = avcodec_parameters_alloc();
+    if (!ctx->dec_ctx || !ctx->dec_par) { ret = AVERROR(ENOMEM); goto fail; }
+    
+    ret = avcodec_parameters_copy(ctx->dec_par, par);
+    if (ret < 0) goto fail;
+    
+    ret = avcodec_parameters_to_context(ctx->dec_ctx, par);
+    if (ret < 0) goto fail;
+    
+    ret = avcodec_open2(ctx->dec_ctx, decoder, NULL);
+    if (ret < 0) goto fail;
+    
+    return 0;
+
+fail:
+    if (ctx->dec_ctx) avcodec_free_context(&ctx->dec_ctx);
+    avcodec_parameters_free(&ctx->dec_par);
+    return ret;
+}
+
+static int worker_context_prepare_resampler(WorkerContext *ctx, const AVCodecContext *dec_ctx,
+                                            int out_rate, int channels) {
+    SwrKey key = {
+        .in_fmt = dec_ctx->sample_fmt,
+        .in_rate = dec_ctx->sample_rate,
+        .out_rate = out_rate,
+        .out_channels = channels,
+        .in_layout = dec_ctx->ch_layout
+    };
+    int ret;
+    
+    // swr_init() on a configured context clears the delay buffers but keeps
+    // the polyphase filter bank when the conversion parameters are unchanged
+    if (ctx->swr_ctx && swr_key_equal(&ctx->swr_key, &key)) {
+        atomic_fetch_add(&swr_cache.hits, 1);
+        return swr_init(ctx->swr_ctx);
+    }
+    
+    if (ctx->swr_ctx) {
+        swr_cache_release(&ctx->swr_key, ctx->swr_ctx);
+        ctx->swr_ctx = NULL;
+    }
+    av_channel_layout_uninit(&ctx->swr_key.in_layout);
+    
+    ctx->swr_ctx = swr_cache_acquire(&key);
+    if (ctx->swr_ctx) {
+        atomic_fetch_add(&swr_cache.hits, 1);
+        ret = swr_init(ctx->swr_ctx);
+        if (ret < 0) goto fail;
+    } else {
+        atomic_fetch_add(&swr_cache.misses, 1);
+        
+        AVChannelLayout dst_ch_layout = {0};
+        av_channel_layout_default(&dst_ch_layout, channels);
+        
+        ret = swr_alloc_set_opts2(&ctx->swr_ctx,
+            &dst_ch_layout, AV_SAMPLE_FMT_FLT, out_rate,
+            &dec_ctx->ch_layout, dec_ctx->sample_fmt, dec_ctx->sample_rate,
+            0, NULL);
+        if (ret < 0 || !ctx->swr_ctx) return ret < 0 ? ret : AVERROR(ENOMEM);
+        
+        av_opt_set_int(ctx->swr_ctx, "filter_size", 64, 0);
+        av_opt_set_double(ctx->swr_ctx, "cutoff", 0.97, 0);
+        
+        ret = swr_init(ctx->swr_ctx);
+        if (ret < 0) goto fail;
+    }
+    
+    ctx->swr_key = key;
+    ctx->swr_key.in_layout = (AVChannelLayout){0};
+    av_channel_layout_copy(&ctx->swr_key.in_layout, &dec_ctx->ch_layout);
+    return 0;
+
+fail:
+    swr_free(&ctx->swr_ctx);
+    return ret;
+}
+
+// Sample formats the decimator and passthrough paths read directly from
+// decoded frames
+static int direct_input_supported(enum AVSampleFormat fmt) {
+    switch (fmt) {
+    case AV_SAMPLE_FMT_S16: case AV_SAMPLE_FMT_S16P:
+    case AV_SAMPLE_FMT_S32: case AV_SAMPLE_FMT_S32P:
+    case AV_SAMPLE_FMT_FLT: case AV_SAMPLE_FMT_FLTP:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int worker_context_prepare_decimator(WorkerContext *ctx, int factor, int channels) {
+    Decimator *d = &ctx->decimator;
+    
+    if (d->coeffs && d->factor == factor && d->channels == channels) {
+        decimator_reset(d);
+    } else {
+        decimator_free(d);
+        if (decimator_init(d, factor, channels, 64, 0.97) < 0) return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+// Picks how decoded audio reaches the target rate: untouched when the rate
+// already matches, the FIR decimator for integer ratios and libswresample
+// for everything else
+static int worker_context_prepare_resample(WorkerContext *ctx, const AVCodecContext *dec_ctx,
+                                           const ProcessorConfig *config, int channels) {
+    int in_sample_rate = dec_ctx->sample_rate;
+    int direct_input = dec_ctx->ch_layout.nb_channels == channels &&
+        direct_input_supported(dec_ctx->sample_fmt);
+    int factor = config->use_decimator ?
+        decimator_factor(in_sample_rate, config->target_sample_rate) : 0;
+    
+    if (direct_input && (uint32_t)in_sample_rate == config->target_sample_rate) {
+        ctx->mode = RESAMPLE_NONE;
+        return 0;
+    }
+    if (direct_input && factor > 0) {
+        ctx->mode = RESAMPLE_DECIMATE;
+        return worker_context_prepare_decimator(ctx, factor, channels);
+    }
+    ctx->mode = RESAMPLE_SWR;
+    return worker_context_prepare_resampler(ctx, dec_ctx, config->target_sample_rate, channels);
+}
+
+// Returns the resampler to the shared cache and drops the decimator, for
+// contexts that only resample a single file
+static void worker_context_release_resampler(WorkerContext *ctx) {
+    if (ctx->swr_ctx) {
+        swr_cache_release(&ctx->swr_key, ctx->swr_ctx);
+        ctx->swr_ctx = NULL;
+    }
+    av_channel_layout_uninit(&ctx->swr_key.in_layout);
+    decimator_free(&ctx->decimator);
+}
+
+// Converts a decoded frame to planar float in the decimator's input buffer
+static int decimator_push_frame(Decimator *d, const AVFrame *frame) {
+    const int channels = d->channels;
+    const int n = frame->nb_samples;
+    float *dst[channels];
+    
+    if (decimator_get_input(d, n, dst) < 0) return AVERROR(ENOMEM);
+    
+    for (int c = 0; c < channels; c++) {
+        float *out = dst[c];
+        switch (frame->format) {
+        case AV_SAMPLE_FMT_FLT: {
+            const float *in = (const float *)frame->extended_data[0] + c;
+            for (int i = 0; i < n; i++) out[i] = in[i * channels];
+            break;
+        }
+        case AV_SAMPLE_FMT_FLTP:
+            memcpy(out, frame->extended_data[c], n * sizeof(float));
+            break;
+        case AV_SAMPLE_FMT_S16: {
+            const int16_t *in = (const int16_t *)frame->extended_data[0] + c;
+            for (int i = 0; i < n; i++) out[i] = in[i * channels] * (1.0f / 32768.0f);
+            break;
+        }
+        case AV_SAMPLE_FMT_S16P: {
+            const int16_t *in = (const int16_t *)frame->extended_data[c];
+            for (int i = 0; i < n; i++) out[i] = in[i] * (1.0f / 32768.0f);
+            break;
+        }
+        case AV_SAMPLE_FMT_S32: {
+            const int32_t *in = (const int32_t *)frame->extended_data[0] + c;
+            for (int i = 0; i < n; i++) out[i] = in[i * channels] * (1.0f / 2147483648.0f);
+            break;
+        }
+        case AV_SAMPLE_FMT_S32P: {
+            const int32_t *in = (const int32_t *)frame->extended_data[c];
+            for (int i = 0; i < n; i++) out[i] = in[i] * (1.0f / 2147483648.0f);
+            break;
+        }
+        default:
+            return AVERROR(EINVAL);
+        }
+    }
+    return n;
+}
+
+// Converts count samples starting at offset of a decoded frame to
+// interleaved float, for input that is already at the target rate
+static void convert_to_interleaved(const AVFrame *frame, int channels, int offset, int count, float *out) {
+    for (int c = 0; c < channels; c++) {
+        float *dst = out + c;
+        switch (frame->format) {
+        case AV_SAMPLE_FMT_FLT: {
+            const float *in = (const float *)frame->extended_data[0] + (size_t)offset * channels + c;
+            for (int i = 0; i < count; i++) dst[i * channels] = in[i * channels];
+            break;
+        }
+        case AV_SAMPLE_FMT_FLTP: {
+            const float *in = (const float *)frame->extended_data[c] + offset;
+            for (int i = 0; i < count; i++) dst[i * channels] = in[i];
+            break;
+        }
+        case AV_SAMPLE_FMT_S16: {
+            const int16_t *in = (const int16_t *)frame->extended_data[0] + (size_t)offset * channels + c;
+            for (int i = 0; i < count; i++) dst[i * channels] = in[i * channels] * (1.0f / 32768.0f);
+            break;
+        }
+        case AV_SAMPLE_FMT_S16P: {
+            const int16_t *in = (const int16_t *)frame->extended_data[c] + offset;
+            for (int i = 0; i < count; i++) dst[i * channels] = in[i] * (1.0f / 32768.0f);
+            break;
+        }
+        case AV_SAMPLE_FMT_S32: {
+            const int32_t *in = (const int32_t *)frame->extended_data[0] + (size_t)offset * channels + c;
+            for (int i = 0; i < count; i++) dst[i * channels] = in[i * channels] * (1.0f / 2147483648.0f);
+            break;
+        }
+        case AV_SAMPLE_FMT_S32P: {
+            const int32_t *in = (const int32_t *)frame->extended_data[c] + offset;
+            for (int i = 0; i < count; i++) dst[i * channels] = in[i] * (1.0f / 2147483648.0f);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+// Layout of a WAV file, as found by probe_wav()
+typedef struct {
+    int format_tag;
+    int channels;
+    int sample_rate;
+    int bits_per_sample;
+    int block_align;
+    uint32_t byte_rate;
+    off_t data_offset;
+    uint64_t data_size;
+} WavInfo;
+
+// Walks the RIFF chunks of a WAV file up to the start of the sample data.
+// Returns 1 on success, 0 for anything that is not a parseable WAV file.
+static int probe_wav(int fd, WavInfo *info) {
+    struct stat st;
+    uint8_t hdr[40];
+    int have_fmt = 0;
+    
+    if (fstat(fd, &st) != 0) return 0;
+    if (pread(fd, hdr, 12, 0) != 12) return 0;
+    if (memcmp(hdr, "RIFF", 4) != 0 || memcmp(hdr + 8, "WAVE", 4) != 0) return 0;
+    
+    off_t pos = 12;
+    while (pos + 8 <= st.st_size) {
+        if (pread(fd, hdr, 8, pos) != 8) return 0;
+        uint32_t chunk_size = get_le32(hdr + 4);
+        
+        if (memcmp(hdr, "fmt ", 4) == 0) {
+            if (chunk_size < 16) return 0;
+            size_t len = chunk_size < sizeof(hdr) ? chunk_size : sizeof(hdr);
+            if (pread(fd, hdr, len, pos + 8) != (ssize_t)len) return 0;
+            
+            info->format_tag = get_le16(hdr);
+            // WAVE_FORMAT_EXTENSIBLE keeps the real format in its sub-format GUID
+            if (info->format_tag == WAV_FORMAT_EXTENSIBLE && len >= 26) info->format_tag = get_le16(hdr + 24);
+            
+            info->channels = get_le16(hdr + 2);
+            info->sample_rate = get_le32(hdr + 4);
+            info->byte_rate = get_le32(hdr + 8);
+            info->block_align = get_le16(hdr + 12);
+            info->bits_per_sample = get_le16(hdr + 14);
+            if (info->channels == 0 || info->block_align == 0) return 0;
+            have_fmt = 1;
+        } else if (memcmp(hdr, "data", 4) == 0) {
+            if (!have_fmt) return 0;
+            info->data_offset = pos + 8;
+            info->data_size = st.st_size - info->data_offset;
+            // Streamed files leave the size at 0 or 0xFFFFFFFF
+            if (chunk_size != 0 && chunk_size != UINT32_MAX && chunk_size < info->data_size) {
+                info->data_size = chunk_size;
+            }
+            return 1;
+        }
+        
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+    return 0;
+}
+
+// Fast path for float32 WAV input that is already at the target rate: the
+// trimmed sample range is copied byte for byte without decoding. Returns 1
+// when the file was handled, 0 when it needs the regular pipeline.
+static int copy_float_wav(ProcessTask *task, int worker) {
+    ProcessorConfig *config = &task->config;
+    WavInfo info = {0};
+    WavWriter writer = { .fd = -1 };
+    int ret = 0;
+    
+    int fd = open(task->input_path, O_RDONLY);
+    if (fd < 0) return 0;
+    
+    if (!probe_wav(fd, &info) ||
+        info.format_tag != WAV_FORMAT_IEEE_FLOAT ||
+        info.bits_per_sample != 32 ||
+        info.block_align != info.channels * (int)sizeof(float) ||
+        (uint32_t)info.sample_rate != config->target_sample_rate ||
+        config->sample_format != SAMPLE_FORMAT_F32 ||
+        config->codec != OUTPUT_WAV ||
+        config->features || config->stats ||
+        config->trim_silence || config->segment) {
+        close(fd);
+        return 0;
+    }
+    
+    size_t max_samples = (size_t)(config->max_duration_sec * config->target_sample_rate);
+    size_t min_samples = (size_t)(config->min_duration_sec * config->target_sample_rate);
+    size_t frames = info.data_size / (info.channels * sizeof(float));
+    if (frames > max_samples) frames = max_samples;
+    
+    ret = output_open(&writer, task, worker, info.sample_rate, info.channels, NULL);
+    if (ret < 0) goto done;
+    
+    ret = wav_writer_copy_range(&writer, fd, info.data_offset, frames);
+    if (ret < 0) goto done;
+    
+    if (frames < min_samples) {
+        ret = wav_writer_write_silence(&writer, min_samples - frames);
+        if (ret < 0) goto done;
+    }
+    
+    ret = output_close(&writer, task, worker);
+
+done:
+    wav_writer_close(&writer);
+    close(fd);
+    return ret < 0 ? ret : 1;
+}
+
+// Segmentation (--segment): one decode is cut into clips of max_duration
+// that start every max_duration - overlap frames. Clip k is written as its
+// own output, <name>_000k.wav or a shard entry keyed <input>_000k, and the
+// last one is padded to min_duration. The clip being filled is held in
+// memory, so an overlap costs one copy of it rather than a second writer.
+#define CLIP_INDEX_FORMAT "%.*s_%04d%s"
+
+typedef struct {
+    ProcessTask *task;
+    int worker;
+    IoEngine *io;
+    int sample_rate;
+    int channels;
+    size_t clip_frames;
+    size_t hop;
+    size_t min_frames;
+    float *buf;
+    size_t fill;
+    int count;                  // clips written
+} ClipOutput;
+
+static int clip_output_init(ClipOutput *c, ProcessTask *task, int worker, IoEngine *io, int channels) {
+    const ProcessorConfig *config = &task->config;
+    
+    memset(c, 0, sizeof(*c));
+    c->task = task;
+    c->worker = worker;
+    c->io = io;
+    c->sample_rate = config->target_sample_rate;
+    c->channels = channels;
+    c->clip_frames = (size_t)(config->max_duration_sec * config->target_sample_rate);
+    c->hop = c->clip_frames - (size_t)(config->segment_overlap_sec * config->target_sample_rate);
+    c->min_frames = (size_t)(config->min_duration_sec * config->target_sample_rate);
+    if (c->clip_frames == 0 || c->hop == 0 || c->hop > c->clip_frames) return AVERROR(EINVAL);
+    
+    c->buf = malloc(c->clip_frames * channels * sizeof(float));
+    return c->buf ? 0 : AVERROR(ENOMEM);
+}
+
+// Writes the first `frames` buffered frames, padded to min_duration, as the
+// next clip
+static int clip_output_emit(ClipOutput *c, size_t frames) {
+    const ProcessTask *task = c->task;
+    const char *base = strrchr(task->input_path, '/');
+    const char *dot = strrchr(base ? base : task->input_path, '.');
+    int input_stem = dot ? (int)(dot - task->input_path) : (int)strlen(task->input_path);
+    int output_stem = (int)(strlen(task->output_path) - strlen(output_extension(&task->config)));
+    WavWriter writer = { .fd = -1 };
+    ProcessTask clip = {
+        .config = task->config,
+        .row = task->row
+    };
+    int ret = 0;
+    
+    if (asprintf(&clip.input_path, CLIP_INDEX_FORMAT, input_stem, task->input_path, c->count,
+                 task->input_path + input_stem) < 0) clip.input_path = NULL;
+    if (asprintf(&clip.output_path, CLIP_INDEX_FORMAT, output_stem, task->output_path, c->count,
+                 task->output_path + output_stem) < 0) clip.output_path = NULL;
+    if (!clip.input_path || !clip.output_path) {
+        ret = AVERROR(ENOMEM);
+        goto done;
+    }
+    if (!pack_output.enabled && asprintf(&clip.part_path, "%s.part", clip.output_path) < 0) {
+        clip.part_path = NULL;
+        ret = AVERROR(ENOMEM);
+        goto done;
+    }
+    
+    ret = output_open(&writer, &clip, c->worker, c->sample_rate, c->channels, c->io);
+    if (ret == 0) ret = wav_writer_write(&writer, c->buf, frames);
+    if (ret == 0 && frames < c->min_frames) ret = wav_writer_write_silence(&writer, c->min_frames - frames);
+    if (ret == 0) ret = output_close(&writer, &clip, c->worker);
+    if (clip.part_path) {
+        if (ret == 0 && rename(clip.part_path, clip.output_path) != 0) ret = AVERROR(errno);
+        if (ret != 0) unlink(clip.part_path);
+    }
+    if (ret == 0) c->count++;
+
+done:
+    wav_writer_close(&writer);
+    free(clip.input_path);
+    free(clip.output_path);
+    free(clip.part_path);
+    return ret;
+}
+
+static int clip_output_write(ClipOutput *c, const float *samples, size_t frames) {
+    size_t overlap = c->clip_frames - c->hop;
+    
+    while (frames > 0) {
+        size_t take = c->clip_frames - c->fill;
+        if (take > frames) take = frames;
+        memcpy(c->buf + c->fill * c->channels, samples, take * c->channels * sizeof(float));
+        c->fill += take;
+        samples += take * c->channels;
+        frames -= take;
+        
+        if (c->fill == c->clip_frames) {
+            int ret = clip_output_emit(c, c->fill);
+            if (ret < 0) return ret;
+            memmove(c->buf, c->buf + c->hop * c->channels, overlap * c->channels * sizeof(float));
+            c->fill = overlap;
+        }
+    }
+    return 0;
+}
+
+// Writes the last clip if it holds frames no earlier clip had, or the only
+// clip of a file too short for one
+static int clip_output_finish(ClipOutput *c) {
+    size_t seen = c->count ? c->clip_frames - c->hop : 0;
+    if (c->fill > seen || c->count == 0) return clip_output_emit(c, c->fill);
+    return 0;
+}
+
+static void clip_output_free(ClipOutput *c) {
+    free(c->buf);
+    c->buf = NULL;
+}
+
+// Output frames produced by decode_stream() are numbered from the start of
+// the file. Frames before `skip` are dropped and nothing at or past `limit`
+// is written, so one decode can fill just a slice of the output. With a
+// VAD gate the frames are counted after it, so decoding stops once
+// `limit` frames of trimmed audio are written. When segmenting, the frames
+// go to the clips and the writer only describes their layout.
+typedef struct {
+    WavWriter *writer;
+    uint64_t pos;
+    uint64_t skip;
+    uint64_t limit;
+    VadGate *vad;
+    ClipOutput *clips;
+} OutputRange;
+
+static int output_range_full(const OutputRange *r) {
+    return r->pos >= r->limit;
+}
+
+static int output_range_emit(void *opaque, const float *samples, size_t frames) {
+    OutputRange *r = opaque;
+    
+    if (r->pos < r->skip) {
+        uint64_t drop = r->skip - r->pos;
+        if (drop > frames) drop = frames;
+        samples += drop * r->writer->channels;
+        frames -= drop;
+        r->pos += drop;
+    }
+    if (output_range_full(r)) return 0;
+    if (frames > r->limit - r->pos) frames = r->limit - r->pos;
+    if (frames == 0) return 0;
+    
+    r->pos += frames;
+    if (r->clips) return clip_output_write(r->clips, samples, frames);
+    return wav_writer_write(r->writer, samples, frames);
+}
+
+static int output_range_write(OutputRange *r, const float *samples, size_t frames) {
+    if (r->vad) return vad_gate_push(r->vad, samples, frames, output_range_emit, r);
+    return output_range_emit(r, samples, frames);
+}
+
+// Lets the gate emit the end of its trailing silence once the input is
+// done, then writes the last clip
+static int output_range_finish(OutputRange *r) {
+    int ret = r->vad ? vad_gate_flush(r->vad, output_range_emit, r) : 0;
+    if (ret == 0 && r->clips) ret = clip_output_finish(r->clips);
+    return ret;
+}
+
+// Drops the first n samples of a decoded frame in place
+static void frame_skip_samples(AVFrame *frame, int n) {
+    int bytes = av_get_bytes_per_sample(frame->format);
+    
+    if (av_sample_fmt_is_planar(frame->format)) {
+        for (int c = 0; c < frame->ch_layout.nb_channels; c++) frame->extended_data[c] += n * bytes;
+    } else {
+        frame->extended_data[0] += (size_t)n * bytes * frame->ch_layout.nb_channels;
+    }
+    frame->nb_samples -= n;
+}
+
+// Places the range on the first frame decoded after a seek. The frame is
+// trimmed to an input sample that maps onto a whole output frame, so the
+// resampler runs in phase with a decode from the start of the file.
+// Returns 1 once placed, 0 if the whole frame precedes that sample, and
+// AVERROR(ERANGE) if decoding started after range->skip.
+static int decode_align_start(AVFrame *frame, const AVStream *stream, int in_rate, int out_rate,
+                              OutputRange *range) {
+    int64_t ts = frame->best_effort_timestamp;
+    if (ts == AV_NOPTS_VALUE) return AVERROR_INVALIDDATA;
+    
+    int64_t origin = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    int64_t in_pos = av_rescale_q(ts - origin, stream->time_base, (AVRational){1, in_rate});
+    
+    int64_t gcd = av_gcd(in_rate, out_rate);
+    int64_t period = in_rate / gcd;
+    int64_t aligned = in_pos > 0 ? (in_pos + period - 1) / period * period : 0;
+    int64_t drop = aligned - in_pos;
+    if (drop >= frame->nb_samples) return 0;
+    
+    frame_skip_samples(frame, (int)drop);
+    range->pos = aligned / period * (out_rate / gcd);
+    if (range->skip > 0 && range->pos > range->skip) return AVERROR(ERANGE);
+    return 1;
+}
+
+// Converts one decoded frame to the target rate and writes the frames that
+// fall inside the range. The frame is unreferenced. buf holds max_out
+// interleaved frames of scratch space.
+static int convert_frame(WorkerContext *ctx, AVFrame *frame, OutputRange *range, float *buf, int max_out) {
+    int channels = range->writer->channels;
+    int ret = 0;
+    
+    if (ctx->mode == RESAMPLE_NONE) {
+        int offset = 0;
+        while (offset < frame->nb_samples && !output_range_full(range)) {
+            size_t chunk = frame->nb_samples - offset;
+            
+            // Frames before the range are skipped without converting them
+            if (range->pos < range->skip) {
+                if (chunk > range->skip - range->pos) chunk = range->skip - range->pos;
+                range->pos += chunk;
+                offset += chunk;
+                continue;
+            }
+            
+            if (frame->format == AV_SAMPLE_FMT_FLT) {
+                const float *in = (const float *)frame->extended_data[0];
+                ret = output_range_write(range, in + (size_t)offset * channels, chunk);
+            } else {
+                if (chunk > (size_t)max_out) chunk = max_out;
+                convert_to_interleaved(frame, channels, offset, chunk, buf);
+                ret = output_range_write(range, buf, chunk);
+            }
+            if (ret < 0) break;
+            
+            offset += chunk;
+        }
+        av_frame_unref(frame);
+        return ret;
+    }
+    
+    if (ctx->mode == RESAMPLE_DECIMATE) {
+        int n_in = decimator_push_frame(&ctx->decimator, frame);
+        av_frame_unref(frame);
+        if (n_in < 0) return n_in;
+        
+        size_t produced;
+        while (!output_range_full(range) &&
+               (produced = decimator_process(&ctx->decimator, n_in, buf, max_out)) > 0) {
+            n_in = 0;
+            ret = output_range_write(range, buf, produced);
+            if (ret < 0) return ret;
+        }
+        return 0;
+    }
+    
+    int out_samples_est = av_rescale_rnd(frame->nb_samples,
+        range->writer->sample_rate, frame->sample_rate, AV_ROUND_UP);
+    
+    uint8_t *out_ptr = (uint8_t *)buf;
+    if (out_samples_est > max_out) out_samples_est = max_out;
+    
+    int converted = swr_convert(ctx->swr_ctx, &out_ptr, out_samples_est,
+        (const uint8_t **)frame->extended_data, frame->nb_samples);
+    
+    av_frame_unref(frame);
+    if (converted <= 0) return 0;
+    
+    return output_range_write(range, buf, converted);
+}
+
+// Drains the samples still held by the resampler into the range
+static int flush_resampler(WorkerContext *ctx, OutputRange *range, float *buf, int max_out) {
+    while (ctx->mode != RESAMPLE_NONE && !output_range_full(range)) {
+        uint8_t *out_ptr = (uint8_t *)buf;
+        int flushed;
+        if (ctx->mode == RESAMPLE_DECIMATE) {
+            flushed = decimator_flush(&ctx->decimator, buf, max_out);
+        } else {
+            flushed = swr_convert(ctx->swr_ctx, &out_ptr, max_out, NULL, 0);
+        }
+        if (flushed <= 0) break;
+        
+        int ret = output_range_write(range, buf, flushed);
+        if (ret < 0) return ret;
+    }
+    return 0;
+}
+
+// Decodes the audio stream from the current read position and writes the
+// converted frames that fall inside the range. With align set the range
+// position comes from the timestamps instead of starting at 0.
+static int decode_stream(WorkerContext *ctx, AVFormatContext *fmt_ctx, int stream_index,
+                         int out_rate, OutputRange *range, int align) {
+    AVCodecContext *dec_ctx = ctx->dec_ctx;
+    AVFrame *dec_frame = ctx->dec_frame;
+    AVPacket *pkt = ctx->pkt;
+    int started = !align;
+    int ret;
+    
+    float resample_buf[8192];
+    int max_out = sizeof(resample_buf) / sizeof(float) / range->writer->channels;
+    
+    // Process packets
+    while (!output_range_full(range) && av_read_frame(fmt_ctx, pkt) >= 0) {
+        if (pkt->stream_index != stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        }
+        
+        ret = avcodec_send_packet(dec_ctx, pkt);
+        av_packet_unref(pkt);
+        if (ret < 0) continue;
+        
+        while (!output_range_full(range) && avcodec_receive_frame(dec_ctx, dec_frame) >= 0) {
+            if (!started) {
+                ret = decode_align_start(dec_frame, fmt_ctx->streams[stream_index],
+                                         dec_ctx->sample_rate, out_rate, range);
+                if (ret <= 0) {
+                    av_frame_unref(dec_frame);
+                    if (ret < 0) return ret;
+                    continue;
+                }
+                started = 1;
+            }
+            
+            ret = convert_frame(ctx, dec_frame, range, resample_buf, max_out);
+            if (ret < 0) return ret;
+        }
+    }
+    
+    return flush_resampler(ctx, range, resample_buf, max_out);
+}
+
+// Incremental mode (--incremental): a manifest in the output directory
+// records the input mtime and size, and a hash of the settings, that every
+// output was produced from. Inputs that still match are dropped by the
+// directory walk before any FFmpeg context is opened. The entries of the
+// previous run are read-only while workers run; files processed in this
+// run are recorded separately and merged when the manifest is saved.
+#define MANIFEST_NAME ".audio_preprocessor.manifest"
+#define MANIFEST_VERSION 1
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+typedef struct {
+    char *input_path;
+    int64_t mtime_ns;
+    uint64_t size;
+    uint64_t config_hash;
+    // Still up to date in this run, so kept when the manifest is saved
+    atomic_int current;
+} ManifestEntry;
+
+typedef struct {
+    int enabled;
+    int check_config;
+    uint64_t config_hash;
+    char *path;
+    // Entries of the previous run and an open-addressing index over them
+    ManifestEntry *entries;
+    size_t count;
+    size_t *slots;
+    size_t mask;
+    // Files written by this run
+    pthread_mutex_t mutex;
+    ManifestEntry *fresh;
+    size_t fresh_count;
+    size_t fresh_capacity;
+    atomic_ulong skipped;
+} Manifest;
+
+static Manifest manifest = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * FNV_PRIME;
+    return h;
+}
+
+// Hash of the settings that change the output samples
+static uint64_t config_hash(const ProcessorConfig *config) {
+    uint32_t fields[] = {
+        MANIFEST_VERSION,
+        config->target_sample_rate,
+        (uint32_t)lrintf(config->min_duration_sec * 1000),
+        (uint32_t)lrintf(config->max_duration_sec * 1000),
+        (uint32_t)config->use_decimator,
+        (uint32_t)config->sample_format,
+        (uint32_t)config->codec,
+        (uint32_t)config->bitrate,
+        (uint32_t)config->features,
+        (uint32_t)config->mel.n_fft,
+        (uint32_t)config->mel.hop,
+        (uint32_t)config->mel.n_mels,
+        (uint32_t)lrintf(config->mel.fmin),
+        (uint32_t)lrintf(config->mel.fmax),
+        (uint32_t)config->stats,
+        (uint32_t)config->mel.n_mfcc,
+        (uint32_t)config->trim_silence,
+        (uint32_t)lrintf(config->vad.threshold_db * 100),
+        (uint32_t)config->vad.hangover_ms,
+        (uint32_t)config->segment,
+        (uint32_t)lrintf(config->segment_overlap_sec * 1000)
+    };
+    return fnv1a(FNV_OFFSET, fields, sizeof(fields));
+}
+
+static uint64_t path_hash(const char *path) {
+    return fnv1a(FNV_OFFSET, path, strlen(path));
+}
+
+static int64_t stat_mtime_ns(const struct stat *st) {
+#ifdef __APPLE__
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+static ManifestEntry *manifest_find(const char *input_path) {
+    if (!manifest.slots) return NULL;
+    
+    size_t i = path_hash(input_path) & manifest.mask;
+    for (; manifest.slots[i]; i = (i + 1) & manifest.mask) {
+        ManifestEntry *e = &manifest.entries[manifest.slots[i] - 1];
+        if (strcmp(e->input_path, input_path) == 0) return e;
+    }
+    return NULL;
+}
+
+// Reads the manifest of the previous run, if there is one. Lines hold
+// "<mtime_ns> <size> <config hash> <input path>".
+static int manifest_load(const char *output_dir, const ProcessorConfig *config, int check_config) {
+    manifest.enabled = 1;
+    manifest.check_config = check_config;
+    manifest.config_hash = config_hash(config);
+    if (asprintf(&manifest.path, "%s/%s", output_dir, MANIFEST_NAME) < 0) {
+        manifest.path = NULL;
+        return AVERROR(ENOMEM);
+    }
+    
+    FILE *f = fopen(manifest.path, "r");
+    if (!f) return errno == ENOENT ? 0 : AVERROR(errno);
+    
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    int ret = 0;
+    
+    while ((len = getline(&line, &line_size, f)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+        
+        ManifestEntry e = {0};
+        int path_start = 0;
+        if (sscanf(line, "%" SCNd64 " %" SCNu64 " %" SCNx64 " %n",
+                   &e.mtime_ns, &e.size, &e.config_hash, &path_start) != 3 || !path_start) {
+            continue;
+        }
+        
+        if (manifest.count >= capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            ManifestEntry *entries = realloc(manifest.entries, capacity * sizeof(ManifestEntry));
+            if (!entries) { ret = AVERROR(ENOMEM); break; }
+            manifest.entries = entries;
+        }
+        e.input_path = strdup(line + path_start);
+        if (!e.input_path) { ret = AVERROR(ENOMEM); break; }
+        manifest.entries[manifest.count++] = e;
+    }
+    free(line);
+    fclose(f);
+    if (ret < 0) return ret;
+    
+    // Index at most half full
+    size_t size = 2;
+    while (size < manifest.count * 2) size *= 2;
+    manifest.slots = calloc(size, sizeof(size_t));
+    if (!manifest.slots) return AVERROR(ENOMEM);
+    manifest.mask = size - 1;
+    
+    for (size_t k = 0; k < manifest.count; k++) {
+        const char *path = manifest.entries[k].input_path;
+        size_t i = path_hash(path) & manifest.mask;
+        while (manifest.slots[i]) i = (i + 1) & manifest.mask;
+        manifest.slots[i] = k + 1;
+    }
+    return 0;
+}
+
+// Whether the task's output was produced from this very input (and, with
+// config checking, with the same settings) by an earlier run
+static int manifest_up_to_date(const ProcessTask *task) {
+    if (!manifest.enabled) return 0;
+    
+    ManifestEntry *e = manifest_find(task->input_path);
+    if (!e || e->mtime_ns != task->input_mtime_ns || e->size != task->input_size) return 0;
+    if (manifest.check_config && e->config_hash != manifest.config_hash) return 0;
+    
+    // Outputs deleted since then are produced again
+    if (access(task->output_path, F_OK) != 0) return 0;
+    if (task->config.features == FEATURES_WITH_AUDIO) {
+        char *sidecar = mel_sidecar_path(task->output_path);
+        int missing = !sidecar || access(sidecar, F_OK) != 0;
+        free(sidecar);
+        if (missing) return 0;
+    }
+    
+    atomic_store(&e->current, 1);
+    atomic_fetch_add(&manifest.skipped, 1);
+    return 1;
+}
+
+static void manifest_record(const ProcessTask *task) {
+    // A path with a newline cannot be stored; it is reprocessed every run
+    if (strchr(task->input_path, '\n')) return;
+    
+    char *path = strdup(task->input_path);
+    if (!path) return;
+    
+    pthread_mutex_lock(&manifest.mutex);
+    if (manifest.fresh_count >= manifest.fresh_capacity) {
+        size_t capacity = manifest.fresh_capacity ? manifest.fresh_capacity * 2 : 1024;
+        ManifestEntry *fresh = realloc(manifest.fresh, capacity * sizeof(ManifestEntry));
+        if (!fresh) {
+            pthread_mutex_unlock(&manifest.mutex);
+            free(path);
+            return;
+        }
+        manifest.fresh = fresh;
+        manifest.fresh_capacity = capacity;
+    }
+    ManifestEntry *e = &manifest.fresh[manifest.fresh_count++];
+    e->input_path = path;
+    e->mtime_ns = task->input_mtime_ns;
+    e->size = task->input_size;
+    e->config_hash = manifest.config_hash;
+    pthread_mutex_unlock(&manifest.mutex);
+}
+
+static void manifest_write_entry(FILE *f, const ManifestEntry *e) {
+    fprintf(f, "%" PRId64 " %" PRIu64 " %016" PRIx64 " %s\n",
+            e->mtime_ns, e->size, e->config_hash, e->input_path);
+}
+
+// Replaces the manifest with the entries still up to date plus the files
+// written in this run. Entries of inputs that are gone or failed are dropped.
+static int manifest_save(void) {
+    if (!manifest.enabled || !manifest.path) return 0;
+    
+    char *tmp_path;
+    if (asprintf(&tmp_path, "%s.tmp", manifest.path) < 0) return AVERROR(ENOMEM);
+    
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        int ret = AVERROR(errno);
+        free(tmp_path);
+        return ret;
+    }
+    
+    for (size_t i = 0; i < manifest.count; i++) {
+        if (atomic_load(&manifest.entries[i].current)) manifest_write_entry(f, &manifest.entries[i]);
+    }
+    for (size_t i = 0; i < manifest.fresh_count; i++) manifest_write_entry(f, &manifest.fresh[i]);
+    
+    int ret = 0;
+    if (ferror(f) || fflush(f) != 0 || fsync(fileno(f)) != 0) ret = AVERROR(EIO);
+    if (fclose(f) != 0 && ret == 0) ret = AVERROR(errno);
+    if (ret == 0 && rename(tmp_path, manifest.path) != 0) ret = AVERROR(errno);
+    if (ret < 0) unlink(tmp_path);
+    free(tmp_path);
+    return ret;
+}
+
+static void manifest_destroy(void) {
+    for (size_t i = 0; i < manifest.count; i++) free(manifest.entries[i].input_path);
+    for (size_t i = 0; i < manifest.fresh_count; i++) free(manifest.fresh[i].input_path);
+    free(manifest.entries);
+    free(manifest.fresh);
+    free(manifest.slots);
+    free(manifest.path);
+}
+
+// Completion journal (--journal, or --resume): every finished output is
+// appended to a journal in the output directory, so a run that dies can be
+// resumed without redoing the files it completed. Workers only append to a
+// memory buffer; a background thread writes it out about once a second.
+// Before each batch the output filesystem is synced (syncfs), or off Linux
+// each output is synced as it is recorded, so no journaled output can be
+// lost to a power failure while its record survives. A batch whose sync
+// fails is not written; its files are redone on resume.
+#define JOURNAL_NAME ".audio_preprocessor.journal"
+#define JOURNAL_SYNC_MS 1000
+#define JOURNAL_FLUSH_BYTES (256 * 1024)
+
+typedef struct {
+    int enabled;
+    int fd;
+    int dir_fd;
+    off_t offset;
+    // Inputs completed by the run being resumed, as an open-addressing set
+    char **done;
+    size_t done_count;
+    size_t *slots;
+    size_t mask;
+    atomic_ulong resumed;
+    // Records waiting for the writer thread
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    char *buf;
+    size_t len;
+    size_t capacity;
+    int stop;
+    pthread_t thread;
+} Journal;
+
+static Journal journal = {
+    .fd = -1,
+    .dir_fd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+// Reads the completed inputs of an earlier run and returns the length of
+// the journal up to its last complete record
+static off_t journal_load(int fd) {
+    FILE *f = fdopen(dup(fd), "r");
+    if (!f) return 0;
+    
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    off_t valid = 0;
+    
+    while ((len = getline(&line, &line_size, f)) > 0) {
+        // A record cut short by a crash is dropped
+        if (line[len - 1] != '\n') break;
+        line[len - 1] = '\0';
+        valid += len;
+        
+        if (journal.done_count >= capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            char **done = realloc(journal.done, capacity * sizeof(char *));
+            if (!done) break;
+            journal.done = done;
+        }
+        if (!(journal.done[journal.done_count] = strdup(line))) break;
+        journal.done_count++;
+    }
+    free(line);
+    fclose(f);
+    
+    size_t size = 2;
+    while (size < journal.done_count * 2) size *= 2;
+    journal.slots = calloc(size, sizeof(size_t));
+    if (!journal.slots) return valid;
+    journal.mask = size - 1;
+    
+    for (size_t k = 0; k < journal.done_count; k++) {
+        size_t i = path_hash(journal.done[k]) & journal.mask;
+        while (journal.slots[i]) i = (i + 1) & journal.mask;
+        journal.slots[i] = k + 1;
+    }
+    return valid;
+}
+
+// Whether the run being resumed already completed the task
+static int journal_done(const ProcessTask *task) {
+    if (!journal.slots) return 0;
+    
+    size_t i = path_hash(task->input_path) & journal.mask;
+    for (; journal.slots[i]; i = (i + 1) & journal.mask) {
+        if (strcmp(journal.done[journal.slots[i] - 1], task->input_path) == 0) {
+            atomic_fetch_add(&journal.resumed, 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Makes the given records durable. Outputs are renamed into place before
+// they are journaled, so syncing the filesystem first covers all of them.
+static int journal_write(const char *buf, size_t len) {
+#ifdef __linux__
+    if (syncfs(journal.dir_fd) != 0) return AVERROR(errno);
+#endif
+    int ret = pwrite_all(journal.fd, buf, len, journal.offset);
+    if (ret < 0) return ret;
+    journal.offset += len;
+    return fdatasync(journal.fd) == 0 ? 0 : AVERROR(errno);
+}
+
+static void *journal_thread(void *arg) {
+    (void)arg;
+    char *buf = NULL;
+    size_t capacity = 0;
+    
+    pthread_mutex_lock(&journal.mutex);
+    while (!journal.stop || journal.len) {
+        // Batch the records of one interval unless the buffer fills first
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += JOURNAL_SYNC_MS / 1000;
+        deadline.tv_nsec += (long)(JOURNAL_SYNC_MS % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!journal.stop && journal.len < JOURNAL_FLUSH_BYTES &&
+               pthread_cond_timedwait(&journal.cond, &journal.mutex, &deadline) != ETIMEDOUT) {
+        }
+        if (!journal.len) continue;
+        
+        // Swap buffers so workers keep appending during the sync
+        char *pending = journal.buf;
+        size_t len = journal.len;
+        size_t pending_capacity = journal.capacity;
+        journal.buf = buf;
+        journal.capacity = capacity;
+        journal.len = 0;
+        pthread_mutex_unlock(&journal.mutex);
+        
+        if (journal_write(pending, len) < 0) {
+            fprintf(stderr, "Failed to sync or journal a batch of outputs, they are redone on resume\n");
+        }
+        
+        pthread_mutex_lock(&journal.mutex);
+        buf = pending;
+        capacity = pending_capacity;
+    }
+    pthread_mutex_unlock(&journal.mutex);
+    
+    free(buf);
+    return NULL;
+}
+
+// Opens the journal of the output directory. Without resume it is started
+// afresh; with resume the completed inputs it lists are skipped.
+static int journal_open(const char *output_dir, int resume) {
+    char *path;
+    if (asprintf(&path, "%s/%s", output_dir, JOURNAL_NAME) < 0) return AVERROR(ENOMEM);
+    
+    journal.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0644);
+    free(path);
+    if (journal.fd < 0) return AVERROR(errno);
+    journal.dir_fd = open(output_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (journal.dir_fd < 0) return AVERROR(errno);
+    
+    if (resume) {
+        journal.offset = journal_load(journal.fd);
+        if (ftruncate(journal.fd, journal.offset) != 0) return AVERROR(errno);
+    }
+    
+    if (pthread_create(&journal.thread, NULL, journal_thread, NULL) != 0) return AVERROR(EAGAIN);
+    journal.enabled = 1;
+    return 0;
+}
+
+#ifndef __linux__
+// Syncs a renamed output and the directory entry pointing at it
+static int journal_sync_output(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return AVERROR(errno);
+    int ret = fsync(fd) == 0 ? 0 : AVERROR(errno);
+    close(fd);
+    if (ret < 0) return ret;
+    
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash - path) : strdup(".");
+    if (!dir) return AVERROR(ENOMEM);
+    fd = open(dir, O_RDONLY | O_CLOEXEC);
+    free(dir);
+    if (fd < 0) return AVERROR(errno);
+    ret = fsync(fd) == 0 ? 0 : AVERROR(errno);
+    close(fd);
+    return ret;
+}
+#endif
+
+static void journal_record(const ProcessTask *task) {
+    // A path with a newline cannot be journaled; it is redone on resume
+    if (strchr(task->input_path, '\n')) return;
+    size_t len = strlen(task->input_path) + 1;
+    
+#ifndef __linux__
+    // Without syncfs each output is made durable before its record is
+    // queued; one that cannot be is redone on resume
+    if (journal_sync_output(task->output_path) < 0) return;
+    if (task->config.features == FEATURES_WITH_AUDIO) {
+        char *sidecar = mel_sidecar_path(task->output_path);
+        int ret = sidecar ? journal_sync_output(sidecar) : AVERROR(ENOMEM);
+        free(sidecar);
+        if (ret < 0) return;
+    }
+#endif
+    
+    pthread_mutex_lock(&journal.mutex);
+    if (journal.len + len > journal.capacity) {
+        size_t capacity = journal.capacity ? journal.capacity : 4096;
+        while (capacity < journal.len + len) capacity *= 2;
+        char *buf = realloc(journal.buf, capacity);
+        if (!buf) {
+            pthread_mutex_unlock(&journal.mutex);
+            return;
+        }
+        journal.buf = buf;
+        journal.capacity = capacity;
+    }
+    memcpy(journal.buf + journal.len, task->input_path, len - 1);
+    journal.buf[journal.len + len - 1] = '\n';
+    journal.len += len;
+    if (journal.len >= JOURNAL_FLUSH_BYTES) pthread_cond_signal(&journal.cond);
+    pthread_mutex_unlock(&journal.mutex);
+}
+
+// Writes the remaining records and stops the writer thread
+static void journal_close(void) {
+    if (journal.enabled) {
+        pthread_mutex_lock(&journal.mutex);
+        journal.stop = 1;
+        pthread_cond_signal(&journal.cond);
+        pthread_mutex_unlock(&journal.mutex);
+        pthread_join(journal.thread, NULL);
+        journal.enabled = 0;
+    }
+    
+    if (journal.fd >= 0) close(journal.fd);
+    if (journal.dir_fd >= 0) close(journal.dir_fd);
+    journal.fd = journal.dir_fd = -1;
+    for (size_t i = 0; i < journal.done_count; i++) free(journal.done[i]);
+    free(journal.done);
+    free(journal.slots);
+    free(journal.buf);
+}
+
+// Content-addressed output cache (--cache-dir): outputs are stored under a
+// key made of an XXH64 of the input bytes and the settings hash, so the
+// same audio under another path or in another dataset version is decoded
+// once. Inputs are hashed with streaming reads on the worker that owns the
+// task, in parallel across workers. A hit is cloned into place: reflinked
+// where the filesystem supports it, else hardlinked, else copied.
+#define CACHE_READ_SIZE (1024 * 1024)
+
+typedef struct {
+    const char *dir;
+    uint64_t config_hash;
+    atomic_ulong hits;
+    atomic_ulong misses;
+    atomic_ulong stores;
+    atomic_ulong next_tmp;
+} OutputCache;
+
+static OutputCache output_cache;
+
+static int hash_file(const char *path, uint64_t *hash) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return AVERROR(errno);
+    
+    uint8_t *buf = malloc(CACHE_READ_SIZE);
+    if (!buf) {
+        close(fd);
+        return AVERROR(ENOMEM);
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    
+    Xxh64State state;
+    xxh64_init(&state, 0);
+    int ret = 0;
+    ssize_t n;
+    while ((n = read(fd, buf, CACHE_READ_SIZE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ret = AVERROR(errno);
+            break;
+        }
+        xxh64_update(&state, buf, n);
+    }
+    
+    free(buf);
+    close(fd);
+    *hash = xxh64_digest(&state);
+    return ret;
+}
+
+// Gives dst the contents of src, replacing any file at dst
+static int clone_file(const char *src, const char *dst) {
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return AVERROR(errno);
+    unlink(dst);
+    
+    int out;
+#ifdef FICLONE
+    out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (out >= 0) {
+        if (ioctl(out, FICLONE, in) == 0) {
+            close(in);
+            return close(out) == 0 ? 0 : AVERROR(errno);
+        }
+        close(out);
+        unlink(dst);
+    }
+#endif
+    
+    if (link(src, dst) == 0) {
+        close(in);
+        return 0;
+    }
+    
+    // Different filesystems: copy the bytes
+    int ret = 0;
+    out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    uint8_t *buf = malloc(CACHE_READ_SIZE);
+    if (out < 0 || !buf) ret = out < 0 ? AVERROR(errno) : AVERROR(ENOMEM);
+    
+    off_t offset = 0;
+    ssize_t n;
+    while (ret == 0 && (n = read(in, buf, CACHE_READ_SIZE)) != 0) {
+        if (n < 0) {
+            if (errno != EINTR) ret = AVERROR(errno);
+            continue;
+        }
+        ret = pwrite_all(out, buf, n, offset);
+        offset += n;
+    }
+    
+    free(buf);
+    close(in);
+    if (out >= 0 && close(out) != 0 && ret == 0) ret = AVERROR(errno);
+    if (ret < 0) unlink(dst);
+    return ret;
+}
+
+// Looks the task's input up in the cache. A hit is cloned to the task's
+// part path and returns 1. On a miss the entry path is kept in the task so
+// finish_task can store the output.
+static int cache_lookup(ProcessTask *task) {
+    if (!output_cache.dir) return 0;
+    
+    uint64_t hash;
+    if (hash_file(task->input_path, &hash) < 0) return 0;
+    
+    char *entry;
+    if (asprintf(&entry, "%s/%02x/%014" PRIx64 "-%016" PRIx64 "%s", output_cache.dir,
+                 (unsigned)(hash >> 56), hash & (UINT64_MAX >> 8), output_cache.config_hash,
+                 output_extension(&task->config)) < 0) {
+        return 0;
+    }
+    
+    if (clone_file(entry, task->part_path) == 0) {
+        atomic_fetch_add(&output_cache.hits, 1);
+        free(entry);
+        return 1;
+    }
+    atomic_fetch_add(&output_cache.misses, 1);
+    task->cache_path = entry;
+    return 0;
+}
+
+// Adds a finished output to the cache under the key found by cache_lookup()
+static void cache_store(const ProcessTask *task) {
+    char *slash = strrchr(task->cache_path, '/');
+    *slash = '\0';
+    mkdir(task->cache_path, 0755);
+    *slash = '/';
+    
+    // Clone under a private name first so readers never see a partial entry
+    char *tmp;
+    if (asprintf(&tmp, "%s.%d.%lu.tmp", task->cache_path, (int)getpid(),
+                 atomic_fetch_add(&output_cache.next_tmp, 1)) < 0) {
+        return;
+    }
+    if (clone_file(task->output_path, tmp) == 0 && rename(tmp, task->cache_path) == 0) {
+        atomic_fetch_add(&output_cache.stores, 1);
+    } else {
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+// Outputs are written under a temporary name and renamed once complete, so
+// a crash never leaves a truncated file under the final name
+static int task_part_path(ProcessTask *task) {
+    // Segmented files name a part file per clip
+    if (pack_output.enabled || npy_output.enabled || task->config.segment) return 0;
+    if (asprintf(&task->part_path, "%s.part", task->output_path) < 0) {
+        task->part_path = NULL;
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+// Reports the outcome of a task. Streamed tasks are freed, so the caller
+// must not touch the task afterwards.
+static void finish_task(ProcessTask *task, int ret) {
+    if (task->part_path) {
+        if (ret == 0 && rename(task->part_path, task->output_path) != 0) ret = AVERROR(errno);
+        if (ret != 0) unlink(task->part_path);
+        free(task->part_path);
+        task->part_path = NULL;
+    }
+    
+    if (ret == 0) {
+        printf("Processed: %s\n", task->input_path);
+        if (manifest.enabled) manifest_record(task);
+        if (journal.enabled) journal_record(task);
+        if (task->cache_path) cache_store(task);
+    } else {
+        fprintf(stderr, "Failed: %s\n", task->input_path);
+    }
+    free(task->cache_path);
+    task->cache_path = NULL;
+    
+    if (task->streamed) {
+        free(task->input_path);
+        free(task->output_path);
+        free(task);
+    }
+}
+
+// Seconds decoded ahead of a segment so the decoder and resampler have
+// settled by its first frame; the output of this warm-up is dropped
+#define SPLIT_WARMUP_SEC 1.0
+#define SPLIT_SEEK_ATTEMPTS 3
+#define SPLIT_MAX_SEGMENTS_PER_WORKER 4
+
+// process_file() result for a split file, which is reported by whichever
+// worker finishes its last segment
+#define PROCESS_DEFERRED 1
+
+typedef struct SplitOutput SplitOutput;
+
+// One time range of a split file, in output frames
+typedef struct {
+    SplitOutput *split;
+    uint64_t start;
+    uint64_t end;
+} FileSegment;
+
+// A long file whose segments are decoded by several workers and written in
+// place into one preallocated WAV file
+struct SplitOutput {
+    ProcessTask *task;
+    int fd;
+    int channels;
+    int segment_count;
+    FileSegment *segments;
+    atomic_int remaining;
+    atomic_int error;
+    _Atomic uint64_t frames_end;
+};
+
+// Scheduler items are ProcessTask pointers, or FileSegment pointers tagged
+// in the low bit so a peek never has to dereference a finished segment
+#define SEGMENT_ITEM(seg) ((void *)((uintptr_t)(seg) | 1))
+#define ITEM_IS_SEGMENT(item) ((uintptr_t)(item) & 1)
+#define ITEM_SEGMENT(item) ((FileSegment *)((uintptr_t)(item) & ~(uintptr_t)1))
+
+// Output frames per segment if the file is long enough to be worth
+// splitting, otherwise 0
+static uint64_t split_segment_frames(const WorkerContext *ctx, const AVFormatContext *fmt_ctx,
+                                     const ProcessorConfig *config, uint64_t expected) {
+    if (config->split_sec <= 0 || !ctx->sched || ctx->workers < 2 || pack_output.enabled ||
+        npy_output.enabled || config->codec != OUTPUT_WAV || config->features || config->stats ||
+        config->trim_silence || config->segment) return 0;
+    
+    // Every segment seeks in its own demuxer
+    if (!fmt_ctx->pb || !(fmt_ctx->pb->seekable & AVIO_SEEKABLE_NORMAL)) return 0;
+    
+    uint64_t frames = (uint64_t)(config->split_sec * config->target_sample_rate);
+    if (frames == 0 || expected < 2 * frames) return 0;
+    
+    uint64_t max_segments = (uint64_t)ctx->workers * SPLIT_MAX_SEGMENTS_PER_WORKER;
+    if (expected / frames > max_segments) frames = (expected + max_segments - 1) / max_segments;
+    return frames;
+}
+
+static int split_output_open(SplitOutput **out, ProcessTask *task, int channels, uint64_t expected,
+                             uint64_t segment_frames, uint64_t max_samples) {
+    SplitOutput *s = calloc(1, sizeof(*s));
+    if (!s) return AVERROR(ENOMEM);
+    
+    s->task = task;
+    s->channels = channels;
+    s->segment_count = (expected + segment_frames - 1) / segment_frames;
+    s->segments = calloc(s->segment_count, sizeof(FileSegment));
+    if (!s->segments) {
+        free(s);
+        return AVERROR(ENOMEM);
+    }
+    
+    // The duration is an estimate, so the last segment runs to the end
+    for (int k = 0; k < s->segment_count; k++) {
+        s->segments[k] = (FileSegment){
+            .split = s,
+            .start = k * segment_frames,
+            .end = k == s->segment_count - 1 ? max_samples : (k + 1) * segment_frames
+        };
+    }
+    atomic_init(&s->remaining, s->segment_count);
+    atomic_init(&s->error, 0);
+    atomic_init(&s->frames_end, 0);
+    
+    s->fd = open(task->part_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (s->fd < 0) {
+        int ret = AVERROR(errno);
+        free(s->segments);
+        free(s);
+        return ret;
+    }
+    
+    // Reserve the expected size up front; segments finish in any order
+    off_t size = wav_header_size(task->config.sample_format) +
+        expected * channels * sample_format_bytes(task->config.sample_format);
+    int reserved = 0;
+#ifdef __linux__
+    reserved = fallocate(s->fd, 0, 0, size) == 0;
+#endif
+    if (!reserved && ftruncate(s->fd, size) != 0) {
+        int ret = AVERROR(errno);
+        close(s->fd);
+        free(s->segments);
+        free(s);
+        return ret;
+    }
+    
+    *out = s;
+    return 0;
+}
+
+// Records a finished segment. The last one to finish sizes the file,
+// writes the header and reports the task.
+static void split_output_segment_done(SplitOutput *s, uint64_t end, int ret) {
+    if (ret < 0) {
+        int none = 0;
+        atomic_compare_exchange_strong(&s->error, &none, ret);
+    }
+    uint64_t cur = atomic_load(&s->frames_end);
+    while (end > cur && !atomic_compare_exchange_weak(&s->frames_end, &cur, end)) {}
+    
+    if (atomic_fetch_sub(&s->remaining, 1) != 1) return;
+    
+    ProcessorConfig *config = &s->task->config;
+    uint64_t min_samples = (uint64_t)(config->min_duration_sec * config->target_sample_rate);
+    uint64_t frames = atomic_load(&s->frames_end);
+    ret = atomic_load(&s->error);
+    
+    // Growing the file pads it with zero bytes, which is silence in every
+    // format but mu-law
+    size_t frame_bytes = s->channels * sample_format_bytes(config->sample_format);
+    int header_size = wav_header_size(config->sample_format);
+    uint64_t written = frames;
+    if (frames < min_samples) frames = min_samples;
+    if (ret == 0 && ftruncate(s->fd, header_size + frames * frame_bytes) != 0) {
+        ret = AVERROR(errno);
+    }
+    if (ret == 0 && frames > written && sample_format_silence(config->sample_format)) {
+        size_t pad = (frames - written) * frame_bytes;
+        uint8_t *silence = malloc(pad);
+        if (!silence) {
+            ret = AVERROR(ENOMEM);
+        } else {
+            memset(silence, sample_format_silence(config->sample_format), pad);
+            ret = pwrite_all(s->fd, silence, pad, header_size + written * frame_bytes);
+            free(silence);
+        }
+    }
+    if (ret == 0) {
+        uint8_t header[WAV_HEADER_MAX_SIZE];
+        wav_build_header(header, config->target_sample_rate, s->channels, config->sample_format, frames);
+        ret = pwrite_all(s->fd, header, header_size, 0);
+    }
+    if (close(s->fd) != 0 && ret == 0) ret = AVERROR(errno);
+    
+    finish_task(s->task, ret);
+    free(s->segments);
+    free(s);
+}
+
+static int process_file(WorkerContext *ctx, ProcessTask *task) {
+    const char *input_path = task->input_path;
+    ProcessorConfig *config = &task->config;
+    AVFormatContext *in_fmt_ctx = NULL;
+    InputSource input = {0};
+    AVCodecContext *dec_ctx = NULL;
+    WavWriter writer = { .fd = -1 };
+    OutputRange range = { .writer = &writer };
+    VadGate vad = {0};
+    ClipOutput clips = {0};
+    SplitOutput *split = NULL;
+    int ret = 0;
+    int stream_index = -1;
+    
+    IoPrefetch *prefetch = task->prefetch;
+    task->prefetch = NULL;
+    
+    ret = task_part_path(task);
+    if (ret == 0) ret = cache_lookup(task);
+    if (ret == 0) {
+        // Float WAV already at the target rate needs no decoding at all
+        ret = copy_float_wav(task, ctx->worker);
+    }
+    if (ret != 0) {
+        // Inputs handled without the demuxer never consume their prefetch
+        if (prefetch) io_prefetch_release(ctx->io, prefetch);
+        return ret < 0 ? ret : 0;
+    }
+    
+    // Open input
+    ret = input_source_open(&input, input_path, config, prefetch, ctx->io, &in_fmt_ctx);
+    if (ret < 0) goto cleanup;
+    
+    ret = avformat_find_stream_info(in_fmt_ctx, NULL);
+    if (ret < 0) goto cleanup;
+    
+    // How much input leading silence takes is unknown until it is decoded,
+    // and segmenting reads it all
+    input_source_hint(&input, in_fmt_ctx, config->trim_silence || config->segment ?
+                      INFINITY : config->max_duration_sec);
+    
+    // Find audio stream
+    stream_index = av_find_best_stream(in_fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (stream_index < 0) { ret = stream_index; goto cleanup; }
+    
+    AVStream *in_stream = in_fmt_ctx->streams[stream_index];
+    ret = worker_context_prepare_decoder(ctx, in_stream->codecpar);
+    if (ret < 0) goto cleanup;
+    dec_ctx = ctx->dec_ctx;
+    
+    int channels = dec_ctx->ch_layout.nb_channels;
+    if (channels == 0) channels = 2;
+    
+    ret = worker_context_prepare_resample(ctx, dec_ctx, config, channels);
+    if (ret < 0) goto cleanup;
+    
+    size_t max_samples = (size_t)(config->max_duration_sec * config->target_sample_rate);
+    size_t min_samples = (size_t)(config->min_duration_sec * config->target_sample_rate);
+    range.limit = config->segment ? UINT64_MAX : max_samples;
+    
+    uint64_t expected = in_fmt_ctx->duration > 0 ?
+        av_rescale(in_fmt_ctx->duration, config->target_sample_rate, AV_TIME_BASE) : 0;
+    if (expected > max_samples) expected = max_samples;
+    
+    uint64_t segment_frames = split_segment_frames(ctx, in_fmt_ctx, config, expected);
+    if (segment_frames) {
+        // Long input: later segments go to the worker's deque for idle
+        // workers to steal, this worker decodes the first one in place
+        ret = split_output_open(&split, task, channels, expected, segment_frames, max_samples);
+        if (ret < 0) goto cleanup;
+        
+        for (int k = split->segment_count - 1; k >= 1; k--) {
+            if (work_scheduler_push(ctx->sched, ctx->worker, SEGMENT_ITEM(&split->segments[k])) < 0) {
+                split_output_segment_done(split, 0, AVERROR(ENOMEM));
+            }
+        }
+        
+        range.limit = split->segments[0].end;
+        ret = wav_writer_open_shared(&writer, split->fd, config->target_sample_rate, channels,
+                                     config->sample_format, 0);
+    } else if (config->segment) {
+        ret = clip_output_init(&clips, task, ctx->worker, ctx->io, channels);
+        if (ret == 0) ret = wav_writer_open_discard(&writer, config->target_sample_rate, channels);
+        range.clips = &clips;
+    } else {
+        ret = output_open(&writer, task, ctx->worker, config->target_sample_rate, channels, ctx->io);
+    }
+    if (ret < 0) goto cleanup;
+    
+    if (config->trim_silence) {
+        if (vad_gate_init(&vad, &config->vad, config->target_sample_rate, channels, max_samples) < 0) {
+            ret = AVERROR(ENOMEM);
+            goto cleanup;
+        }
+        range.vad = &vad;
+    }
+    
+    ret = decode_stream(ctx, in_fmt_ctx, stream_index, config->target_sample_rate, &range, split != NULL);
+    if (ret == 0) ret = output_range_finish(&range);
+    if (ret < 0) goto cleanup;
+    
+    // Pad with silence if needed
+    if (!split && !range.clips && range.pos < min_samples) {
+        ret = wav_writer_write_silence(&writer, min_samples - range.pos);
+        if (ret < 0) goto cleanup;
+    }
+    
+    if (split || range.clips) ret = wav_writer_close(&writer);
+    else ret = output_close(&writer, task, ctx->worker);
+
+cleanup:
+    wav_writer_close(&writer);
+    vad_gate_free(&vad);
+    clip_output_free(&clips);
+    av_packet_unref(ctx->pkt);
+    av_frame_unref(ctx->dec_frame);
+    if (ret < 0) worker_context_reset(ctx);
+    input_source_close(&input, &in_fmt_ctx);
+    
+    if (split) {
+        split_output_segment_done(split, range.pos, ret);
+        return PROCESS_DEFERRED;
+    }
+    return ret;
+}
+
+// Decodes one segment of a split file into its slice of the shared output
+static void process_segment(WorkerContext *ctx, FileSegment *seg) {
+    SplitOutput *split = seg->split;
+    ProcessorConfig *config = &split->task->config;
+    AVFormatContext *in_fmt_ctx = NULL;
+    InputSource input = {0};
+    WavWriter writer = { .fd = -1 };
+    OutputRange range = { .writer = &writer, .skip = seg->start, .limit = seg->end };
+    double warmup_sec = SPLIT_WARMUP_SEC;
+    int ret;
+    
+    ret = input_source_open(&input, split->task->input_path, config, NULL, NULL, &in_fmt_ctx);
+    if (ret < 0) goto cleanup;
+    
+    ret = avformat_find_stream_info(in_fmt_ctx, NULL);
+    if (ret < 0) goto cleanup;
+    
+    int stream_index = av_find_best_stream(in_fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (stream_index < 0) { ret = stream_index; goto cleanup; }
+    
+    AVStream *in_stream = in_fmt_ctx->streams[stream_index];
+    ret = worker_context_prepare_decoder(ctx, in_stream->codecpar);
+    if (ret < 0) goto cleanup;
+    
+    ret = wav_writer_open_shared(&writer, split->fd, config->target_sample_rate, split->channels,
+                                 config->sample_format, seg->start);
+    if (ret < 0) goto cleanup;
+    
+    int64_t origin = in_stream->start_time != AV_NOPTS_VALUE ? in_stream->start_time : 0;
+    for (int attempt = 0; attempt < SPLIT_SEEK_ATTEMPTS; attempt++) {
+        double start_sec = (double)seg->start / config->target_sample_rate - warmup_sec;
+        int64_t ts = origin;
+        if (start_sec > 0) {
+            ts += av_rescale_q((int64_t)(start_sec * AV_TIME_BASE), AV_TIME_BASE_Q, in_stream->time_base);
+        }
+        
+        ret = av_seek_frame(in_fmt_ctx, stream_index, ts, AVSEEK_FLAG_BACKWARD);
+        if (ret < 0) goto cleanup;
+        avcodec_flush_buffers(ctx->dec_ctx);
+        
+        ret = worker_context_prepare_resample(ctx, ctx->dec_ctx, config, split->channels);
+        if (ret < 0) goto cleanup;
+        
+        range.pos = 0;
+        ret = decode_stream(ctx, in_fmt_ctx, stream_index, config->target_sample_rate, &range, 1);
+        
+        // The demuxer landed after the segment start: seek further back
+        if (ret != AVERROR(ERANGE)) break;
+        warmup_sec *= 4;
+    }
+    if (ret < 0) goto cleanup;
+    
+    ret = wav_writer_close(&writer);
+
+cleanup:
+    wav_writer_close(&writer);
+    av_packet_unref(ctx->pkt);
+    av_frame_unref(ctx->dec_frame);
+    if (ret < 0) worker_context_reset(ctx);
+    input_source_close(&input, &in_fmt_ctx);
+    
+    split_output_segment_done(split, range.pos, ret);
+}
+
+// Starts reading a task's input unless another worker already did or the
+// task has been claimed for processing
+static void task_prefetch(IoEngine *io, ProcessTask *task) {
+    int expected = PREFETCH_IDLE;
+    if (!atomic_compare_exchange_strong(&task->prefetch_state, &expected, PREFETCH_ISSUING)) return;
+    task->prefetch = io_engine_prefetch(io, task->input_path, INPUT_PREFETCH_MAX);
+    atomic_store_explicit(&task->prefetch_state, PREFETCH_READY, memory_order_release);
+}
+
+// Stops further prefetches of the task and waits for one being issued, so
+// task->prefetch is stable afterwards
+static void task_claim_prefetch(ProcessTask *task) {
+    int expected = PREFETCH_IDLE;
+    if (atomic_compare_exchange_strong(&task->prefetch_state, &expected, PREFETCH_CLAIMED)) return;
+    while (atomic_load_explicit(&task->prefetch_state, memory_order_acquire) == PREFETCH_ISSUING) {
+        sched_yield();
+    }
+}
+
+static void *worker_thread(void *arg) {
+    ThreadPool *pool = (ThreadPool *)arg;
+    int worker = atomic_fetch_add(&pool->next_worker, 1);
+    WorkerContext ctx;
+    
+    if (worker_context_init(&ctx) < 0) {
+        fprintf(stderr, "Failed to allocate worker state\n");
+        worker_context_free(&ctx);
+        // The other workers steal this worker's share
+        return NULL;
+    }
+    ctx.io = pool->io;
+    ctx.sched = &pool->sched;
+    ctx.worker = worker;
+    ctx.workers = pool->num_threads;
+    
+    void *item;
+    while ((item = work_scheduler_next(&pool->sched, worker))) {
+        if (ITEM_IS_SEGMENT(item)) {
+            process_segment(&ctx, ITEM_SEGMENT(item));
+            work_scheduler_done(&pool->sched);
+            continue;
+        }
+        ProcessTask *task = item;
+        
+        // Keep reads of the next few inputs of this worker's deque in flight
+        if (pool->io) {
+            for (int i = 0; i < pool->prefetch_window; i++) {
+                void *next = work_scheduler_peek(&pool->sched, worker, i);
+                if (!next) break;
+                if (!ITEM_IS_SEGMENT(next)) task_prefetch(pool->io, next);
+            }
+        }
+        
+        task_claim_prefetch(task);
+        int ret = process_file(&ctx, task);
+        
+        // A deferred task is finished by whichever worker ends its last
+        // segment and may already be gone
+        if (ret != PROCESS_DEFERRED) finish_task(task, ret);
+        work_scheduler_done(&pool->sched);
+    }
+    
+    worker_context_free(&ctx);
+    return NULL;
+}
+
+// Deals the tasks to the workers' deques. Tasks are dealt round-robin so
+// every worker starts on the largest of its share; readdir order is dealt in
+// runs to keep neighbouring files on one worker.
+static int seed_tasks(WorkScheduler *sched, ProcessTask *tasks, int task_count, int workers, long chunk) {
+    void **items = malloc(task_count * sizeof(void *));
+    if (!items || work_scheduler_init(sched, workers) < 0) {
+        free(items);
+        return AVERROR(ENOMEM);
+    }
+    for (int i = 0; i < task_count; i++) items[i] = &tasks[i];
+    
+    int ret = work_scheduler_seed(sched, items, task_count, chunk) < 0 ? AVERROR(ENOMEM) : 0;
+    free(items);
+    return ret;
+}
+
+// Pipelined execution (--pipeline): separate thread pools decode, resample
+// and write, connected by bounded lock-free queues, so decoding of one file
+// overlaps with resampling of the previous one and with output I/O.
+//
+// Decode threads take files from a work-stealing scheduler and pass frame
+// batches to the resample thread the file is pinned to, which keeps every
+// file's frames in order without locking. Resample threads hand full output
+// buffers, tagged with their file offset, to a shared write queue that any
+// write thread can serve. A file is finalized by whichever stage releases
+// the last reference to it.
+
+#define PIPELINE_STAGES 3
+#define PIPELINE_BATCH_FRAMES 16
+#define PIPELINE_QUEUE_DEPTH 64
+#define PIPELINE_WRITE_QUEUE_DEPTH 256
+
+typedef struct Pipeline Pipeline;
+
+typedef struct {
+    Pipeline *pipeline;
+    ProcessTask *task;
+    WorkQueue *queue;           // resample thread this file is pinned to
+    WorkerContext resampler;    // only the resampler state is used
+    WavWriter writer;
+    OutputRange range;
+    int fd;
+    // Queued writes, plus one held by the resample stage until it is done
+    atomic_int pending;
+    atomic_int error;
+} PipelineFile;
+
+typedef struct {
+    PipelineFile *file;
+    AVFrame *frames[PIPELINE_BATCH_FRAMES];
+    int count;
+} FrameBatch;
+
+typedef struct {
+    PipelineFile *file;
+    uint8_t *buf;
+    size_t len;
+    uint64_t offset;
+} WriteRequest;
+
+// Resample queues carry FrameBatch pointers, and the file itself with the
+// low bit set once its decoder is done
+#define FILE_END_ITEM(file) ((void *)((uintptr_t)(file) | 1))
+#define ITEM_IS_FILE_END(item) ((uintptr_t)(item) & 1)
+#define ITEM_FILE_END(item) ((PipelineFile *)((uintptr_t)(item) & ~(uintptr_t)1))
+
+typedef struct {
+    const char *name;
+    _Atomic uint64_t busy_ns;
+    _Atomic uint64_t wall_ns;
+} StageStats;
+
+struct Pipeline {
+    int threads[PIPELINE_STAGES];
+    WorkScheduler sched;
+    WorkQueue *resample_queues;
+    WorkQueue write_queue;
+    atomic_int next_thread[PIPELINE_STAGES];
+    atomic_int next_queue;
+    StageStats stats[PIPELINE_STAGES];
+};
+
+enum { STAGE_DECODE, STAGE_RESAMPLE, STAGE_WRITE };
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Time the calling stage thread spent blocked on a queue or the scheduler
+static _Thread_local uint64_t stage_wait_ns;
+
+static void pipeline_push(WorkQueue *q, void *item) {
+    if (work_queue_try_push(q, item)) return;
+    uint64_t t0 = now_ns();
+    work_queue_push(q, item);
+    stage_wait_ns += now_ns() - t0;
+}
+
+static void *pipeline_pop(WorkQueue *q) {
+    void *item = work_queue_try_pop(q);
+    if (item) return item;
+    uint64_t t0 = now_ns();
+    item = work_queue_pop(q);
+    stage_wait_ns += now_ns() - t0;
+    return item;
+}
+
+static void stage_account(Pipeline *pl, int stage, uint64_t start) {
+    uint64_t wall = now_ns() - start;
+    uint64_t busy = wall > stage_wait_ns ? wall - stage_wait_ns : 0;
+    atomic_fetch_add(&pl->stats[stage].busy_ns, busy);
+    atomic_fetch_add(&pl->stats[stage].wall_ns, wall);
+}
+
+static void pipeline_file_fail(PipelineFile *file, int error) {
+    int none = 0;
+    atomic_compare_exchange_strong(&file->error, &none, error);
+}
+
+// Drops a reference. The last one patches the header and reports the file.
+static void pipeline_file_put(PipelineFile *file) {
+    if (atomic_fetch_sub(&file->pending, 1) != 1) return;
+    
+    // Anything still buffered after a failure is written synchronously
+    file->writer.submit = NULL;
+    int ret = wav_writer_close(&file->writer);
+    int error = atomic_load(&file->error);
+    if (error < 0) ret = error;
+    
+    finish_task(file->task, ret);
+    free(file);
+}
+
+static int pipeline_submit_write(void *opaque, uint8_t *buf, size_t len, uint64_t offset) {
+    PipelineFile *file = opaque;
+    WriteRequest *req = malloc(sizeof(*req));
+    if (!req) {
+        free(buf);
+        return AVERROR(ENOMEM);
+    }
+    *req = (WriteRequest){ .file = file, .buf = buf, .len = len, .offset = offset };
+    
+    atomic_fetch_add(&file->pending, 1);
+    pipeline_push(&file->pipeline->write_queue, req);
+    return 0;
+}
+
+static int pipeline_file_open(Pipeline *pl, ProcessTask *task, const AVCodecContext *dec_ctx,
+                              int channels, PipelineFile **out) {
+    ProcessorConfig *config = &task->config;
+    int ret;
+    
+    PipelineFile *file = calloc(1, sizeof(*file));
+    if (!file) return AVERROR(ENOMEM);
+    file->pipeline = pl;
+    file->task = task;
+    file->writer.fd = -1;
+    atomic_init(&file->pending, 1);
+    atomic_init(&file->error, 0);
+    
+    int queue = atomic_fetch_add(&pl->next_queue, 1) % pl->threads[STAGE_RESAMPLE];
+    file->queue = &pl->resample_queues[queue];
+    
+    ret = worker_context_prepare_resample(&file->resampler, dec_ctx, config, channels);
+    if (ret < 0) goto fail;
+    
+    ret = wav_writer_open(&file->writer, task->part_path, config->target_sample_rate, channels,
+                          config->sample_format, NULL);
+    if (ret < 0) goto fail;
+    file->writer.submit = pipeline_submit_write;
+    file->writer.submit_opaque = file;
+    file->fd = file->writer.fd;
+    
+    file->range = (OutputRange){
+        .writer = &file->writer,
+        .limit = (uint64_t)(config->max_duration_sec * config->target_sample_rate)
+    };
+    
+    *out = file;
+    return 0;
+
+fail:
+    wav_writer_close(&file->writer);
+    worker_context_release_resampler(&file->resampler);
+    free(file);
+    return ret;
+}
+
+// Decode stage for one file. Returns PROCESS_DEFERRED once the file has
+// entered the pipeline, otherwise the result to report.
+static int pipeline_decode_file(Pipeline *pl, WorkerContext *ctx, ProcessTask *task) {
+    ProcessorConfig *config = &task->config;
+    AVFormatContext *in_fmt_ctx = NULL;
+    InputSource input = {0};
+    PipelineFile *file = NULL;
+    FrameBatch *batch = NULL;
+    int ret;
+    
+    ret = task_part_path(task);
+    if (ret == 0) ret = cache_lookup(task);
+    if (ret != 0) return ret < 0 ? ret : 0;
+    
+    ret = copy_float_wav(task, 0);
+    if (ret != 0) return ret < 0 ? ret : 0;
+    
+    ret = input_source_open(&input, task->input_path, config, NULL, NULL, &in_fmt_ctx);
+    if (ret < 0) goto cleanup;
+    
+    ret = avformat_find_stream_info(in_fmt_ctx, NULL);
+    if (ret < 0) goto cleanup;
+    
+    input_source_hint(&input, in_fmt_ctx, config->max_duration_sec);
+    
+    int stream_index = av_find_best_stream(in_fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (stream_index < 0) { ret = stream_index; goto cleanup; }
+    
+    ret = worker_context_prepare_decoder(ctx, in_fmt_ctx->streams[stream_index]->codecpar);
+    if (ret < 0) goto cleanup;
+    AVCodecContext *dec_ctx = ctx->dec_ctx;
+    
+    int channels = dec_ctx->ch_layout.nb_channels;
+    if (channels == 0) channels = 2;
+    
+    ret = pipeline_file_open(pl, task, dec_ctx, channels, &file);
+    if (ret < 0) goto cleanup;
+    
+    // The decoder cannot see how much output the resampler has produced, so
+    // it stops after the input for max_duration plus a second of lookahead
+    uint64_t max_input = av_rescale(file->range.limit, dec_ctx->sample_rate, config->target_sample_rate) +
+        dec_ctx->sample_rate;
+    uint64_t decoded = 0;
+    
+    while (decoded < max_input && av_read_frame(in_fmt_ctx, ctx->pkt) >= 0) {
+        if (ctx->pkt->stream_index != stream_index) {
+            av_packet_unref(ctx->pkt);
+            continue;
+        }
+        
+        ret = avcodec_send_packet(dec_ctx, ctx->pkt);
+        av_packet_unref(ctx->pkt);
+        if (ret < 0) continue;
+        
+        while (decoded < max_input && avcodec_receive_frame(dec_ctx, ctx->dec_frame) >= 0) {
+            if (!batch) {
+                batch = calloc(1, sizeof(*batch));
+                if (!batch) { ret = AVERROR(ENOMEM); goto cleanup; }
+                batch->file = file;
+            }
+            
+            AVFrame *frame = av_frame_alloc();
+            if (!frame) { ret = AVERROR(ENOMEM); goto cleanup; }
+            av_frame_move_ref(frame, ctx->dec_frame);
+            decoded += frame->nb_samples;
+            
+            batch->frames[batch->count++] = frame;
+            if (batch->count == PIPELINE_BATCH_FRAMES) {
+                pipeline_push(file->queue, batch);
+                batch = NULL;
+            }
+        }
+    }
+    ret = 0;
+
+cleanup:
+    if (file) {
+        if (batch) pipeline_push(file->queue, batch);
+        if (ret < 0) pipeline_file_fail(file, ret);
+        pipeline_push(file->queue, FILE_END_ITEM(file));
+    }
+    av_packet_unref(ctx->pkt);
+    av_frame_unref(ctx->dec_frame);
+    if (ret < 0) worker_context_reset(ctx);
+    input_source_close(&input, &in_fmt_ctx);
+    
+    return file ? PROCESS_DEFERRED : ret;
+}
+
+static void *pipeline_decode_thread(void *arg) {
+    Pipeline *pl = arg;
+    int worker = atomic_fetch_add(&pl->next_thread[STAGE_DECODE], 1);
+    uint64_t start = now_ns();
+    WorkerContext ctx;
+    
+    if (worker_context_init(&ctx) < 0) {
+        fprintf(stderr, "Failed to allocate worker state\n");
+        worker_context_free(&ctx);
+        return NULL;
+    }
+    
+    for (;;) {
+        uint64_t t0 = now_ns();
+        ProcessTask *task = work_scheduler_next(&pl->sched, worker);
+        stage_wait_ns += now_ns() - t0;
+        if (!task) break;
+        
+        int ret = pipeline_decode_file(pl, &ctx, task);
+        if (ret != PROCESS_DEFERRED) finish_task(task, ret);
+        work_scheduler_done(&pl->sched);
+    }
+    
+    worker_context_free(&ctx);
+    stage_account(pl, STAGE_DECODE, start);
+    return NULL;
+}
+
+// Flushes the resampler, pads to min_duration and queues the tail of the
+// output once the decoder has delivered every frame of the file
+static void pipeline_finish_file(PipelineFile *file, float *buf, int max_out) {
+    ProcessorConfig *config = &file->task->config;
+    uint64_t min_samples = (uint64_t)(config->min_duration_sec * config->target_sample_rate);
+    int ret = atomic_load(&file->error);
+    
+    if (ret == 0) ret = flush_resampler(&file->resampler, &file->range, buf, max_out);
+    if (ret == 0 && file->range.pos < min_samples) {
+        ret = wav_writer_write_silence(&file->writer, min_samples - file->range.pos);
+    }
+    if (ret == 0) ret = wav_writer_flush(&file->writer);
+    if (ret < 0) pipeline_file_fail(file, ret);
+    
+    worker_context_release_resampler(&file->resampler);
+    pipeline_file_put(file);
+}
+
+static void *pipeline_resample_thread(void *arg) {
+    Pipeline *pl = arg;
+    int index = atomic_fetch_add(&pl->next_thread[STAGE_RESAMPLE], 1);
+    WorkQueue *queue = &pl->resample_queues[index];
+    uint64_t start = now_ns();
+    float resample_buf[8192];
+    void *item;
+    
+    while ((item = pipeline_pop(queue))) {
+        if (ITEM_IS_FILE_END(item)) {
+            PipelineFile *file = ITEM_FILE_END(item);
+            pipeline_finish_file(file, resample_buf, sizeof(resample_buf) / sizeof(float) / file->writer.channels);
+            continue;
+        }
+        
+        FrameBatch *batch = item;
+        PipelineFile *file = batch->file;
+        int max_out = sizeof(resample_buf) / sizeof(float) / file->writer.channels;
+        
+        for (int i = 0; i < batch->count; i++) {
+            if (atomic_load_explicit(&file->error, memory_order_relaxed) == 0 &&
+                !output_range_full(&file->range)) {
+                int ret = convert_frame(&file->resampler, batch->frames[i], &file->range, resample_buf, max_out);
+                if (ret < 0) pipeline_file_fail(file, ret);
+            }
+            av_frame_free(&batch->frames[i]);
+        }
+        free(batch);
+    }
+    
+    stage_account(pl, STAGE_RESAMPLE, start);
+    return NULL;
+}
+
+static void *pipeline_write_thread(void *arg) {
+    Pipeline *pl = arg;
+    uint64_t start = now_ns();
+    WriteRequest *req;
+    
+    while ((req = pipeline_pop(&pl->write_queue))) {
+        PipelineFile *file = req->file;
+        if (atomic_load_explicit(&file->error, memory_order_relaxed) == 0) {
+            int ret = pwrite_all(file->fd, req->buf, req->len, req->offset);
+            if (ret < 0) pipeline_file_fail(file, ret);
+        }
+        free(req->buf);
+        free(req);
+        pipeline_file_put(file);
+    }
+    
+    stage_account(pl, STAGE_WRITE, start);
+    return NULL;
+}
+
+// Runs every task of the pipeline's scheduler, which the caller has seeded
+// or is feeding, and returns once every file has been written
+static int pipeline_run(Pipeline *pl) {
+    static const char *names[PIPELINE_STAGES] = { "decode", "resample", "write" };
+    void *(*entry[PIPELINE_STAGES])(void *) = {
+        pipeline_decode_thread, pipeline_resample_thread, pipeline_write_thread
+    };
+    
+    for (int s = 0; s < PIPELINE_STAGES; s++) {
+        pl->stats[s].name = names[s];
+        atomic_init(&pl->stats[s].busy_ns, 0);
+        atomic_init(&pl->stats[s].wall_ns, 0);
+        atomic_init(&pl->next_thread[s], 0);
+    }
+    atomic_init(&pl->next_queue, 0);
+    
+    pl->resample_queues = calloc(pl->threads[STAGE_RESAMPLE], sizeof(WorkQueue));
+    if (!pl->resample_queues) return AVERROR(ENOMEM);
+    for (int i = 0; i < pl->threads[STAGE_RESAMPLE]; i++) {
+        if (work_queue_init(&pl->resample_queues[i], PIPELINE_QUEUE_DEPTH) < 0) return AVERROR(ENOMEM);
+    }
+    if (work_queue_init(&pl->write_queue, PIPELINE_WRITE_QUEUE_DEPTH) < 0) return AVERROR(ENOMEM);
+    
+    pthread_t *threads[PIPELINE_STAGES];
+    for (int s = 0; s < PIPELINE_STAGES; s++) {
+        threads[s] = malloc(pl->threads[s] * sizeof(pthread_t));
+        if (!threads[s]) return AVERROR(ENOMEM);
+        for (int i = 0; i < pl->threads[s]; i++) {
+            pthread_create(&threads[s][i], NULL, entry[s], pl);
+        }
+    }
+    
+    // Stages shut down front to back as their input queues drain
+    for (int i = 0; i < pl->threads[STAGE_DECODE]; i++) pthread_join(threads[STAGE_DECODE][i], NULL);
+    for (int i = 0; i < pl->threads[STAGE_RESAMPLE]; i++) work_queue_close(&pl->resample_queues[i]);
+    for (int i = 0; i < pl->threads[STAGE_RESAMPLE]; i++) pthread_join(threads[STAGE_RESAMPLE][i], NULL);
+    work_queue_close(&pl->write_queue);
+    for (int i = 0; i < pl->threads[STAGE_WRITE]; i++) pthread_join(threads[STAGE_WRITE][i], NULL);
+    
+    for (int s = 0; s < PIPELINE_STAGES; s++) free(threads[s]);
+    return 0;
+}
+
+// Prints how busy each stage was and how full its input queue ran
+static void pipeline_report(Pipeline *pl) {
+    printf("Pipeline occupancy:\n");
+    for (int s = 0; s < PIPELINE_STAGES; s++) {
+        StageStats *st = &pl->stats[s];
+        uint64_t wall = atomic_load(&st->wall_ns);
+        double busy = wall ? 100.0 * atomic_load(&st->busy_ns) / wall : 0.0;
+        printf("  %-8s %3d threads %5.1f%% busy", st->name, pl->threads[s], busy);
+        
+        if (s == STAGE_RESAMPLE) {
+            double fill = 0.0;
+            for (int i = 0; i < pl->threads[s]; i++) fill += work_queue_occupancy(&pl->resample_queues[i]);
+            printf(", input queue %.0f%% full", 100.0 * fill / pl->threads[s]);
+        } else if (s == STAGE_WRITE) {
+            printf(", input queue %.0f%% full", 100.0 * work_queue_occupancy(&pl->write_queue));
+        }
+        printf("\n");
+    }
+}
+
+static void pipeline_destroy(Pipeline *pl) {
+    if (pl->resample_queues) {
+        for (int i = 0; i < pl->threads[STAGE_RESAMPLE]; i++) work_queue_destroy(&pl->resample_queues[i]);
+        free(pl->resample_queues);
+        pl->resample_queues = NULL;
+    }
+    work_queue_destroy(&pl->write_queue);
+    work_scheduler_destroy(&pl->sched);
+}
+
+// Receives every audio file the directory walk finds. The sink takes
+// ownership of the task's paths, also when it fails; a negative return
+// stops the walk.
+typedef int (*TaskSink)(void *opaque, ProcessTask *task);
+
+// Parallel directory walk. Every directory is an item of a work-stealing
+// scheduler: a walker lists it and pushes the subdirectories onto its own
+// deque, so each walker descends depth-first while idle walkers steal the
+// shallowest pending directories, which hold the largest subtrees.
+// Subdirectories are opened relative to their parent's descriptor and
+// entries are classified by d_type, so most of them cost neither a path
+// lookup nor a stat.
+#define WALK_BATCH 256
+#define WALK_DENTS_SIZE (256 * 1024)
+
+typedef struct WalkDir {
+    // Held until this directory has been opened relative to it
+    struct WalkDir *parent;
+    int fd;
+    // The listing plus every subdirectory not yet opened
+    atomic_int refs;
+    // Path below the input directory, "" for the root
+    char *rel;
+    const char *name;
+} WalkDir;
+
+typedef struct {
+    const char *input_dir;
+    const char *output_dir;
+    ProcessorConfig *config;
+    // Size scheduling and the manifest need st_size and st_mtime, which
+    // d_type does not provide
+    int need_stat;
+    WorkScheduler sched;
+    atomic_int next_worker;
+    // Tasks of one directory reach the sink as one run
+    pthread_mutex_t sink_lock;
+    TaskSink sink;
+    void *opaque;
+    atomic_int stopped;
+} TreeWalk;
+
+typedef struct {
+    TreeWalk *walk;
+    int worker;
+    ProcessTask *batch;
+    int count;
+    uint8_t *dents;
+} WalkThread;
+
+#ifdef __linux__
+// Record layout of getdents64(2), which older glibc does not export
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} WalkDirent;
+#endif
+
+static WalkDir *walk_dir_new(WalkDir *parent, char *rel, const char *name) {
+    WalkDir *d = calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    d->parent = parent;
+    d->fd = -1;
+    atomic_init(&d->refs, 1);
+    d->rel = rel;
+    d->name = name;
+    if (parent) atomic_fetch_add(&parent->refs, 1);
+    return d;
+}
+
+static void walk_dir_put(WalkDir *d) {
+    if (atomic_fetch_sub(&d->refs, 1) != 1) return;
     
-    // Setup output
-    ret = avformat_alloc_output_context2(&out_fmt_ctx, NULL, "wav", output_path);
-    if (ret < 0 || !out_fmt_ctx) goto cleanup;
+    // Only set if the walk stopped before this directory was listed
+    if (d->parent) walk_dir_put(d->parent);
+    if (d->fd >= 0) close(d->fd);
+    free(d->rel);
+    free(d);
+}
+
+// Hands the batched tasks to the sink. After a failure the rest are freed.
+static void walk_flush(WalkThread *t) {
+    TreeWalk *walk = t->walk;
     
-    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_PCM_F32LE);
-    if (!encoder) { ret = -1; goto cleanup; }
+    pthread_mutex_lock(&walk->sink_lock);
+    for (int i = 0; i < t->count; i++) {
+        ProcessTask *task = &t->batch[i];
+        if (atomic_load(&walk->stopped)) {
+            free(task->input_path);
+            free(task->output_path);
+        } else if (walk->sink(walk->opaque, task) < 0) {
+            atomic_store(&walk->stopped, 1);
+        }
+    }
+    pthread_mutex_unlock(&walk->sink_lock);
+    t->count = 0;
+}
+
+static int walk_add_file(WalkThread *t, WalkDir *dir, const char *name, const struct stat *st) {
+    TreeWalk *walk = t->walk;
+    const char *sep = dir->rel[0] ? "/" : "";
+    const char *dot = strrchr(name, '.');
+    int stem_len = dot ? (int)(dot - name) : (int)strlen(name);
     
-    AVStream *out_stream = avformat_new_stream(out_fmt_ctx, encoder);
-    if (!out_stream) { ret = -1; goto cleanup; }
+    ProcessTask *task = &t->batch[t->count];
+    memset(task, 0, sizeof(*task));
+    if (asprintf(&task->input_path, "%s%s%s/%s", walk->input_dir, sep, dir->rel, name) < 0) {
+        return AVERROR(ENOMEM);
+    }
+    if (asprintf(&task->output_path, "%s%s%s/%.*s%s", walk->output_dir, sep, dir->rel,
+                 stem_len, name, output_extension(walk->config)) < 0) {
+        free(task->input_path);
+        return AVERROR(ENOMEM);
+    }
+    task->config = *walk->config;
+    if (st) {
+        task->input_size = st->st_size;
+        task->input_mtime_ns = stat_mtime_ns(st);
+    }
+    atomic_init(&task->prefetch_state, PREFETCH_IDLE);
     
-    enc_ctx = avcodec_alloc_context3(encoder);
-    if (!enc_ctx) { ret = -1; goto cleanup; }
+    if (manifest_up_to_date(task) || journal_done(task)) {
+        free(task->input_path);
+        free(task->output_path);
+        return 0;
+    }
     
-    enc_ctx->sample_fmt = AV_SAMPLE_FMT_FLT;
-    enc_ctx->sample_rate = config->target_sample_rate;
-    av_channel_layout_default(&enc_ctx->ch_layout, channels);
-    enc_ctx->bit_rate = config->target_sample_rate * channels * 32;
+    if (++t->count == WALK_BATCH) walk_flush(t);
+    return 0;
+}
+
+static int walk_entry(WalkThread *t, WalkDir *dir, const char *name, unsigned char type) {
+    TreeWalk *walk = t->walk;
+    struct stat st;
+    int have_stat = 0;
     
-    if (out_fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
-        enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if (name[0] == '.') return 0;
     
-    ret = avcodec_open2(enc_ctx, encoder, NULL);
-    if (ret < 0) goto cleanup;
+    // Filesystems without d_type report DT_UNKNOWN; symlinks are followed
+    if (type == DT_UNKNOWN || type == DT_LNK) {
+        if (fstatat(dir->fd, name, &st, 0) != 0) return 0;
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        have_stat = 1;
+    }
     
-    ret = avcodec_parameters_from_context(out_stream->codecpar, enc_ctx);
-    if (ret < 0) goto cleanup;
+    if (type == DT_DIR) {
+        char *rel;
+        if (dir->rel[0]) {
+            if (asprintf(&rel, "%s/%s", dir->rel, name) < 0) return AVERROR(ENOMEM);
+        } else if (!(rel = strdup(name))) {
+            return AVERROR(ENOMEM);
+        }
+        
+        WalkDir *child = walk_dir_new(dir, rel, rel + strlen(rel) - strlen(name));
+        if (!child) {
+            free(rel);
+            return AVERROR(ENOMEM);
+        }
+        if (work_scheduler_push(&walk->sched, t->worker, child) < 0) {
+            walk_dir_put(child);
+            return AVERROR(ENOMEM);
+        }
+    } else if (type == DT_REG && is_audio_file(name)) {
+        if (walk->need_stat && !have_stat) {
+            if (fstatat(dir->fd, name, &st, 0) != 0) return 0;
+            have_stat = 1;
+        }
+        return walk_add_file(t, dir, name, have_stat ? &st : NULL);
+    }
+    return 0;
+}
+
+static void walk_list(WalkThread *t, WalkDir *dir) {
+    int ret = 0;
     
-    out_stream->time_base = (AVRational){1, config->target_sample_rate};
+    dir->fd = openat(dir->parent ? dir->parent->fd : AT_FDCWD, dir->name,
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir->parent) {
+        walk_dir_put(dir->parent);
+        dir->parent = NULL;
+    }
+    if (dir->fd < 0) return;
     
-    if (!(out_fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
-        ret = avio_open(&out_fmt_ctx->pb, output_path, AVIO_FLAG_WRITE);
-        if (ret < 0) goto cleanup;
+#ifdef __linux__
+    // One call returns hundreds of entries, where readdir() would use a
+    // 32 KB buffer; every call is a round trip on network filesystems
+    long n;
+    while (ret == 0 && (n = syscall(SYS_getdents64, dir->fd, t->dents, WALK_DENTS_SIZE)) > 0) {
+        for (long off = 0; ret == 0 && off < n;) {
+            WalkDirent *e = (WalkDirent *)(t->dents + off);
+            off += e->d_reclen;
+            ret = walk_entry(t, dir, e->d_name, e->d_type);
+        }
+    }
+#else
+    int fd = dup(dir->fd);
+    DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!d) {
+        if (fd >= 0) close(fd);
+        return;
     }
     
-    ret = avformat_write_header(out_fmt_ctx, NULL);
-    if (ret < 0) goto cleanup;
+    struct dirent *entry;
+    while (ret == 0 && (entry = readdir(d)) != NULL) {
+        ret = walk_entry(t, dir, entry->d_name, entry->d_type);
+    }
+    closedir(d);
+#endif
     
-    // Setup resampler
-    AVChannelLayout dst_ch_layout = {0};
-    av_channel_layout_default(&dst_ch_layout, channels);
+    if (ret < 0) atomic_store(&t->walk->stopped, 1);
+    walk_flush(t);
+}
+
+static void *walk_thread(void *arg) {
+    TreeWalk *walk = arg;
+    WalkThread t = {
+        .walk = walk,
+        .worker = atomic_fetch_add(&walk->next_worker, 1)
+    };
     
-    ret = swr_alloc_set_opts2(&swr_ctx,
-        &dst_ch_layout, AV_SAMPLE_FMT_FLT, config->target_sample_rate,
-        &dec_ctx->ch_layout, dec_ctx->sample_fmt, dec_ctx->sample_rate,
-        0, NULL);
-    if (ret < 0 || !swr_ctx) goto cleanup;
+    t.batch = malloc(WALK_BATCH * sizeof(ProcessTask));
+#ifdef __linux__
+    t.dents = malloc(WALK_DENTS_SIZE);
+    if (!t.dents) {
+        free(t.batch);
+        t.batch = NULL;
+    }
+#endif
+    // The other walkers steal this walker's share
+    if (!t.batch) return NULL;
     
-    av_opt_set_int(swr_ctx, "filter_size", 64, 0);
-    av_opt_set_double(swr_ctx, "cutoff", 0.97, 0);
+    WalkDir *dir;
+    while ((dir = work_scheduler_next(&walk->sched, t.worker))) {
+        if (!atomic_load(&walk->stopped)) walk_list(&t, dir);
+        walk_dir_put(dir);
+        work_scheduler_done(&walk->sched);
+    }
     
-    ret = swr_init(swr_ctx);
-    if (ret < 0) goto cleanup;
+    free(t.batch);
+    free(t.dents);
+    return NULL;
+}
+
+// Walks the input tree with `threads` threads and hands every audio file
+// to the sink, which is never called concurrently. Files the manifest
+// marks up to date and files a resumed run already completed are left
+// out. Returns AVERROR_EXIT if the sink or an allocation failed.
+static int walk_tree(const char *input_dir, const char *output_dir, ProcessorConfig *config,
+                     int threads, int need_size, TaskSink sink, void *opaque) {
+    TreeWalk walk = {
+        .input_dir = input_dir,
+        .output_dir = output_dir,
+        .config = config,
+        .need_stat = need_size || manifest.enabled,
+        .sink = sink,
+        .opaque = opaque
+    };
+    atomic_init(&walk.next_worker, 0);
+    atomic_init(&walk.stopped, 0);
     
-    // Allocate frames and packets
-    dec_frame = av_frame_alloc();
-    enc_frame = av_frame_alloc();
-    pkt = av_packet_alloc();
-    out_pkt = av_packet_alloc();
-    if (!dec_frame || !enc_frame || !pkt || !out_pkt) { ret = -1; goto cleanup; }
+    if (threads < 1) threads = 1;
     
-    size_t max_samples = (size_t)(config->max_duration_sec * config->target_sample_rate);
-    size_t min_samples = (size_t)(config->min_duration_sec * config->target_sample_rate);
-    size_t total_output_samples = 0;
-    int64_t pts = 0;
+    char *root_rel = strdup("");
+    void *root = root_rel ? walk_dir_new(NULL, root_rel, input_dir) : NULL;
+    pthread_t *tids = malloc(threads * sizeof(pthread_t));
+    if (!root || !tids || work_scheduler_init(&walk.sched, threads) < 0) {
+        if (root) walk_dir_put(root);
+        else free(root_rel);
+        free(tids);
+        return AVERROR_EXIT;
+    }
+    work_scheduler_seed(&walk.sched, &root, 1, 1);
+    pthread_mutex_init(&walk.sink_lock, NULL);
     
-    float resample_buf[8192];
-    int frame_size = 1024;
+    for (int i = 0; i < threads; i++) pthread_create(&tids[i], NULL, walk_thread, &walk);
+    for (int i = 0; i < threads; i++) pthread_join(tids[i], NULL);
     
-    // Process packets
-    while (av_read_frame(in_fmt_ctx, pkt) >= 0) {
-        if (pkt->stream_index != stream_index) {
-            av_packet_unref(pkt);
-            continue;
-        }
-        
-        ret = avcodec_send_packet(dec_ctx, pkt);
-        av_packet_unref(pkt);
-        if (ret < 0) continue;
-        
-        while (avcodec_receive_frame(dec_ctx, dec_frame) >= 0) {
-            if (total_output_samples >= max_samples) {
-                av_frame_unref(dec_frame);
-                break;
-            }
-            
-            int out_samples_est = av_rescale_rnd(dec_frame->nb_samples,
-                config->target_sample_rate, in_sample_rate, AV_ROUND_UP);
-            
-            uint8_t *out_ptr = (uint8_t *)resample_buf;
-            int max_out = sizeof(resample_buf) / sizeof(float) / channels;
-            if (out_samples_est > max_out) out_samples_est = max_out;
-            
-            int converted = swr_convert(swr_ctx, &out_ptr, out_samples_est,
-                (const uint8_t **)dec_frame->extended_data, dec_frame->nb_samples);
-            
-            av_frame_unref(dec_frame);
-            if (converted <= 0) continue;
-            
-            size_t samples_to_write = converted;
-            size_t remaining = max_samples - total_output_samples;
-            if (samples_to_write > remaining) samples_to_write = remaining;
-            
-            size_t offset = 0;
-            while (offset < samples_to_write) {
-                size_t chunk = frame_size;
-                if (chunk > samples_to_write - offset) chunk = samples_to_write - offset;
-                
-                av_frame_unref(enc_frame);
-                enc_frame->format = AV_SAMPLE_FMT_FLT;
-                enc_frame->sample_rate = config->target_sample_rate;
-                av_channel_layout_default(&enc_frame->ch_layout, channels);
-                enc_frame->nb_samples = chunk;
-                
-                ret = av_frame_get_buffer(enc_frame, 0);
-                if (ret < 0) break;
-                
-                memcpy(enc_frame->extended_data[0], 
-                       &resample_buf[offset * channels], 
-                       chunk * channels * sizeof(float));
-                
-                enc_frame->pts = pts;
-                pts += chunk;
-                
-                ret = avcodec_send_frame(enc_ctx, enc_frame);
-                if (ret < 0) continue;
-                
-                while (avcodec_receive_packet(enc_ctx, out_pkt) >= 0) {
-                    av_packet_rescale_ts(out_pkt, enc_ctx->time_base, out_stream->time_base);
-                    out_pkt->stream_index = out_stream->index;
-                    av_interleaved_write_frame(out_fmt_ctx, out_pkt);
-                    av_packet_unref(out_pkt);
-                }
-                
-                offset += chunk;
-            }
-            
-            total_output_samples += samples_to_write;
-            if (total_output_samples >= max_samples) break;
+    pthread_mutex_destroy(&walk.sink_lock);
+    work_scheduler_destroy(&walk.sched);
+    free(tids);
+    return atomic_load(&walk.stopped) ? AVERROR_EXIT : 0;
+}
+
+typedef struct {
+    ProcessTask *tasks;
+    int count;
+    int capacity;
+} TaskList;
+
+static int task_list_add(void *opaque, ProcessTask *task) {
+    TaskList *list = opaque;
+    if (list->count >= list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 256;
+        ProcessTask *tasks = realloc(list->tasks, capacity * sizeof(ProcessTask));
+        if (!tasks) {
+            free(task->input_path);
+            free(task->output_path);
+            return AVERROR(ENOMEM);
         }
-        
-        if (total_output_samples >= max_samples) break;
+        list->tasks = tasks;
+        list->capacity = capacity;
     }
+    list->tasks[list->count++] = *task;
+    return 0;
+}
+
+// Typical compressed byte rates, used to guess durations without decoding
+static const struct {
+    const char *ext;
+    double bytes_per_sec;
+} codec_byte_rates[] = {
+    {".mp3", 16000}, {".m4a", 16000}, {".aac", 16000}, {".wma", 16000},
+    {".ogg", 14000}, {".opus", 8000}, {".flac", 90000}, {".wav", 176400},
+    {NULL, 0}
+};
+
+// Estimated seconds of audio in a task's input. WAV headers give the exact
+// figure; other formats are estimated from file size and a typical bitrate.
+static double estimate_duration_sec(const ProcessTask *task) {
+    const char *ext = strrchr(task->input_path, '.');
+    double bytes_per_sec = 16000;
     
-    // Flush resampler
-    while (total_output_samples < max_samples) {
-        uint8_t *out_ptr = (uint8_t *)resample_buf;
-        int max_out = sizeof(resample_buf) / sizeof(float) / channels;
-        int flushed = swr_convert(swr_ctx, &out_ptr, max_out, NULL, 0);
-        if (flushed <= 0) break;
-        
-        size_t samples_to_write = flushed;
-        size_t remaining = max_samples - total_output_samples;
-        if (samples_to_write > remaining) samples_to_write = remaining;
-        
-        size_t offset = 0;
-        while (offset < samples_to_write) {
-            size_t chunk = frame_size;
-            if (chunk > samples_to_write - offset) chunk = samples_to_write - offset;
-            
-            av_frame_unref(enc_frame);
-            enc_frame->format = AV_SAMPLE_FMT_FLT;
-            enc_frame->sample_rate = config->target_sample_rate;
-            av_channel_layout_default(&enc_frame->ch_layout, channels);
-            enc_frame->nb_samples = chunk;
-            
-            ret = av_frame_get_buffer(enc_frame, 0);
-            if (ret < 0) break;
-            
-            memcpy(enc_frame->extended_data[0],
-                   &resample_buf[offset * channels],
-                   chunk * channels * sizeof(float));
-            
-            enc_frame->pts = pts;
-            pts += chunk;
-            
-            avcodec_send_frame(enc_ctx, enc_frame);
-            while (avcodec_receive_packet(enc_ctx, out_pkt) >= 0) {
-                av_packet_rescale_ts(out_pkt, enc_ctx->time_base, out_stream->time_base);
-                out_pkt->stream_index = out_stream->index;
-                av_interleaved_write_frame(out_fmt_ctx, out_pkt);
-                av_packet_unref(out_pkt);
-            }
-            
-            offset += chunk;
-        }
-        
-        total_output_samples += samples_to_write;
-    }
+    if (!ext) return task->input_size / bytes_per_sec;
     
-    // Pad with silence if needed
-    if (total_output_samples < min_samples) {
-        memset(resample_buf, 0, sizeof(resample_buf));
-        size_t silence_remaining = min_samples - total_output_samples;
-        
-        while (silence_remaining > 0) {
-            size_t chunk = frame_size;
-            if (chunk > silence_remaining) chunk = silence_remaining;
-            
-            av_frame_unref(enc_frame);
-            enc_frame->format = AV_SAMPLE_FMT_FLT;
-            enc_frame->sample_rate = config->target_sample_rate;
-            av_channel_layout_default(&enc_frame->ch_layout, channels);
-            enc_frame->nb_samples = chunk;
-            
-            ret = av_frame_get_buffer(enc_frame, 0);
-            if (ret < 0) break;
-            
-            memset(enc_frame->extended_data[0], 0, chunk * channels * sizeof(float));
-            
-            enc_frame->pts = pts;
-            pts += chunk;
-            
-            avcodec_send_frame(enc_ctx, enc_frame);
-            while (avcodec_receive_packet(enc_ctx, out_pkt) >= 0) {
-                av_packet_rescale_ts(out_pkt, enc_ctx->time_base, out_stream->time_base);
-                out_pkt->stream_index = out_stream->index;
-                av_interleaved_write_frame(out_fmt_ctx, out_pkt);
-                av_packet_unref(out_pkt);
-            }
-            
-            silence_remaining -= chunk;
+    for (int i = 0; codec_byte_rates[i].ext; i++) {
+        if (strcasecmp(ext, codec_byte_rates[i].ext) == 0) {
+            bytes_per_sec = codec_byte_rates[i].bytes_per_sec;
+            break;
         }
     }
     
-    // Flush encoder
-    avcodec_send_frame(enc_ctx, NULL);
-    while (avcodec_receive_packet(enc_ctx, out_pkt) >= 0) {
-        av_packet_rescale_ts(out_pkt, enc_ctx->time_base, out_stream->time_base);
-        out_pkt->stream_index = out_stream->index;
-        av_interleaved_write_frame(out_fmt_ctx, out_pkt);
-        av_packet_unref(out_pkt);
-    }
-    
-    av_write_trailer(out_fmt_ctx);
-    ret = 0;
-
-cleanup:
-    av_packet_free(&out_pkt);
-    av_packet_free(&pkt);
-    av_frame_free(&enc_frame);
-    av_frame_free(&dec_frame);
-    swr_free(&swr_ctx);
-    if (enc_ctx) avcodec_free_context(&enc_ctx);
-    if (dec_ctx) avcodec_free_context(&dec_ctx);
-    if (out_fmt_ctx) {
-        if (!(out_fmt_ctx->oformat->flags & AVFMT_NOFILE))
-            avio_closep(&out_fmt_ctx->pb);
-        avformat_free_context(out_fmt_ctx);
+    if (strcasecmp(ext, ".wav") == 0) {
+        WavInfo info = {0};
+        int fd = open(task->input_path, O_RDONLY);
+        if (fd >= 0) {
+            if (probe_wav(fd, &info) && info.byte_rate > 0) bytes_per_sec = info.byte_rate;
+            close(fd);
+        }
     }
-    if (in_fmt_ctx) avformat_close_input(&in_fmt_ctx);
     
-    return ret;
+    return task->input_size / bytes_per_sec;
 }
 
-static void *worker_thread(void *arg) {
-    ThreadPool *pool = (ThreadPool *)arg;
-    
-    while (1) {
-        pthread_mutex_lock(&pool->mutex);
-        int task_idx = pool->next_task++;
-        pthread_mutex_unlock(&pool->mutex);
-        
-        if (task_idx >= pool->task_count) break;
-        
-        ProcessTask *task = &pool->tasks[task_idx];
-        int ret = process_file(task->input_path, task->output_path, &task->config);
-        
-        if (ret == 0) {
-            printf("Processed: %s\n", task->input_path);
-        } else {
-            fprintf(stderr, "Failed: %s\n", task->input_path);
-        }
-    }
-    
-    return NULL;
+static int compare_task_cost(const void *a, const void *b) {
+    const ProcessTask *ta = a, *tb = b;
+    if (ta->est_cost != tb->est_cost) return ta->est_cost < tb->est_cost ? 1 : -1;
+    return strcmp(ta->input_path, tb->input_path);
 }
 
-static int collect_files_recursive(const char *dir_path, const char *rel_path,
-                                   const char *output_dir, ProcessorConfig *config,
-                                   ProcessTask **tasks, int *count, int *capacity) {
-    DIR *dir = opendir(dir_path);
-    if (!dir) return -1;
+// Orders tasks longest-first so the biggest inputs start early and the run
+// does not end with a single thread working through one huge file
+static void schedule_tasks(ProcessTask *tasks, int count, ScheduleMode mode) {
+    if (mode == SCHEDULE_READDIR) return;
     
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] == '.') continue;
-        
-        char full_path[4096];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
-        
-        char new_rel_path[4096];
-        if (rel_path[0]) {
-            snprintf(new_rel_path, sizeof(new_rel_path), "%s/%s", rel_path, entry->d_name);
+    for (int i = 0; i < count; i++) {
+        ProcessTask *task = &tasks[i];
+        if (mode == SCHEDULE_SIZE) {
+            task->est_cost = (double)task->input_size;
         } else {
-            snprintf(new_rel_path, sizeof(new_rel_path), "%s", entry->d_name);
-        }
-        
-        struct stat st;
-        if (stat(full_path, &st) != 0) continue;
-        
-        if (S_ISDIR(st.st_mode)) {
-            collect_files_recursive(full_path, new_rel_path, output_dir, config, tasks, count, capacity);
-        } else if (S_ISREG(st.st_mode) && is_audio_file(entry->d_name)) {
-            if (*count >= *capacity) {
-                *capacity = *capacity ? *capacity * 2 : 256;
-                *tasks = realloc(*tasks, *capacity * sizeof(ProcessTask));
+            // Decoding stops at max_duration, so longer audio costs no more,
+            // unless segmenting or trimming silence reads the whole file
+            const ProcessorConfig *config = &task->config;
+            double duration = estimate_duration_sec(task);
+            if (!config->segment && !config->trim_silence && duration > config->max_duration_sec) {
+                duration = config->max_duration_sec;
             }
-            
-            // Build output path
-            char *dot = strrchr(entry->d_name, '.');
-            size_t stem_len = dot ? (size_t)(dot - entry->d_name) : strlen(entry->d_name);
-            
-            char output_path[4096];
-            if (rel_path[0]) {
-                char *last_slash = strrchr(new_rel_path, '/');
-                if (last_slash) {
-                    *last_slash = '\0';
-                    snprintf(output_path, sizeof(output_path), "%s/%s/%.*s.wav",
-                             output_dir, new_rel_path, (int)stem_len, entry->d_name);
-                    *last_slash = '/';
-                } else {
-                    snprintf(output_path, sizeof(output_path), "%s/%.*s.wav",
-                             output_dir, (int)stem_len, entry->d_name);
-                }
-            } else {
-                snprintf(output_path, sizeof(output_path), "%s/%.*s.wav",
-                         output_dir, (int)stem_len, entry->d_name);
-            }
-            
-            ProcessTask *task = &(*tasks)[*count];
-            task->input_path = strdup(full_path);
-            task->output_path = strdup(output_path);
-            task->config = *config;
-            (*count)++;
+            task->est_cost = duration;
         }
     }
     
-    closedir(dir);
-    return 0;
+    qsort(tasks, count, sizeof(ProcessTask), compare_task_cost);
 }
 
+#define IO_QUEUE_DEPTH 256
+#define IO_PREFETCH_BUDGET ((size_t)512 * 1024 * 1024)
+#define SCHEDULE_READDIR_CHUNK 16
+#define SPLIT_DEFAULT_SEC 300.0f
+
 static void ensure_dir(const char *path) {
     char tmp[4096];
     snprintf(tmp, sizeof(tmp), "%s", path);
@@ -440,6 +4396,97 @@ static void ensure_dir(const char *path) {
     mkdir(tmp, 0755);
 }
 
+// Streaming discovery (--schedule stream): the directory walk runs on its
+// own thread and pushes every audio file onto a deque of its own, which the
+// workers steal from oldest first. Processing starts with the first file
+// found, and the walk pauses while enough tasks are waiting so the pending
+// tasks take bounded memory however large the tree is.
+#define DISCOVERY_PENDING_PER_WORKER 16
+#define DISCOVERY_WAIT_NS 200000
+
+typedef struct {
+    const char *input_dir;
+    const char *output_dir;
+    ProcessorConfig *config;
+    int walk_threads;
+    WorkScheduler *sched;
+    int deque;
+    long max_pending;
+    // Output directory of the previous task; files of one directory arrive
+    // together, so each is created once
+    char *last_dir;
+    long found;
+    pthread_t thread;
+} Discovery;
+
+static int discovery_push(void *opaque, ProcessTask *task) {
+    Discovery *d = opaque;
+    ProcessTask *t = malloc(sizeof(*t));
+    if (!t) goto fail;
+    *t = *task;
+    t->streamed = 1;
+    
+    const char *slash = strrchr(t->output_path, '/');
+    size_t dir_len = slash ? (size_t)(slash - t->output_path) : 0;
+    if (dir_len && !pack_output.enabled && (!d->last_dir || strncmp(d->last_dir, t->output_path, dir_len) != 0 ||
+                    d->last_dir[dir_len] != '\0')) {
+        free(d->last_dir);
+        d->last_dir = strndup(t->output_path, dir_len);
+        if (!d->last_dir) goto fail;
+        ensure_dir(d->last_dir);
+    }
+    
+    while (work_scheduler_pending(d->sched, d->deque) >= d->max_pending) {
+        struct timespec ts = {0, DISCOVERY_WAIT_NS};
+        nanosleep(&ts, NULL);
+    }
+    
+    if (work_scheduler_push(d->sched, d->deque, t) < 0) goto fail;
+    d->found++;
+    return 0;
+
+fail:
+    free(task->input_path);
+    free(task->output_path);
+    free(t);
+    return AVERROR(ENOMEM);
+}
+
+static void *discovery_thread(void *arg) {
+    Discovery *d = arg;
+    
+    if (walk_tree(d->input_dir, d->output_dir, d->config, d->walk_threads, 0,
+                  discovery_push, d) == AVERROR_EXIT) {
+        fprintf(stderr, "Out of memory, stopped scanning %s\n", d->input_dir);
+    }
+    
+    // Workers may finish once the queued tasks are done
+    work_scheduler_done(d->sched);
+    return NULL;
+}
+
+// Sets up the scheduler for `workers` workers plus the walk's own deque and
+// starts the walk
+static int discovery_start(Discovery *d, WorkScheduler *sched, int workers) {
+    if (work_scheduler_init(sched, workers + 1) < 0) return AVERROR(ENOMEM);
+    d->sched = sched;
+    d->deque = workers;
+    d->max_pending = (long)workers * DISCOVERY_PENDING_PER_WORKER;
+    
+    work_scheduler_hold(sched);
+    if (pthread_create(&d->thread, NULL, discovery_thread, d) != 0) {
+        work_scheduler_done(sched);
+        return AVERROR(EAGAIN);
+    }
+    return 0;
+}
+
+static void discovery_join(Discovery *d) {
+    pthread_join(d->thread, NULL);
+    free(d->last_dir);
+    d->last_dir = NULL;
+}
+
 int main(int argc, char **argv) {
     if (argc < 3) {
         printf("Usage: %s <input_dir> <output_dir> [options]\n\n", argv[0]);
@@ -448,6 +4495,52 @@ int main(int argc, char **argv) {
         printf("  --min-duration <sec>   Minimum duration (default: 3.0)\n");
         printf("  --max-duration <sec>   Maximum duration (default: 5.0)\n");
         printf("  --threads <num>        Number of threads (default: auto)\n");
+        printf("  --no-decimator         Always resample with libswresample\n");
+        printf("  --format <fmt>         Output samples: f32, s16 (dithered), s24 or ulaw\n");
+        printf("                         (default: f32)\n");
+        printf("  --codec <codec>        Output container: wav, flac or opus (default: wav)\n");
+        printf("  --bitrate <bps>        Opus bitrate (default: %d)\n", OPUS_DEFAULT_BITRATE);
+        printf("  --mmap                 Read inputs through a memory mapping\n");
+        printf("  --io-uring             Prefetch inputs and write outputs with io_uring\n");
+        printf("  --schedule <mode>      Task order: size, duration, readdir or stream (default: size)\n");
+        printf("                         stream processes files while the tree is still scanned\n");
+        printf("  --pipeline <d:r:w>     Run decode, resample and write as separate stages with\n");
+        printf("                         d, r and w threads (e.g. 4:2:1)\n");
+        printf("  --split-sec <sec>      Decode files longer than twice this in parallel segments\n");
+        printf("                         of this length (default: 300, 0 disables)\n");
+        printf("  --incremental <mode>   Skip inputs unchanged since the last run: input compares\n");
+        printf("                         mtime and size, config also the settings\n");
+        printf("  --cache-dir <dir>      Reuse outputs of identical inputs and settings from a\n");
+        printf("                         content-addressed cache in dir\n");
+        printf("  --journal              Record finished files so an interrupted run can be\n");
+        printf("                         resumed\n");
+        printf("  --resume               Skip the files an interrupted run with --journal in this\n");
+        printf("                         output directory completed, and keep journaling\n");
+        printf("  --pack                 Append all outputs as raw float32 to one shard per\n");
+        printf("                         thread, with a sorted index in index.bin\n");
+        printf("  --tar-shards <MB>      Write outputs into WebDataset tar shards, one per thread,\n");
+        printf("                         starting a new one past this size\n");
+        printf("  --npy <channels>       Write all clips, padded to the maximum duration, into\n");
+        printf("                         one (files, channels, frames) float32 array in data.npy\n");
+        printf("  --mel                  Also write a log-mel spectrogram of each output to\n");
+        printf("                         <name>.mel.npy\n");
+        printf("  --mel-only             Write the log-mel spectrogram instead of the audio\n");
+        printf("  --n-fft <n>            FFT size, a power of two (default: %d)\n", MEL_DEFAULT_N_FFT);
+        printf("  --hop <n>              Hop between frames in samples (default: %d)\n", MEL_DEFAULT_HOP);
+        printf("  --n-mels <n>           Mel bands (default: %d)\n", MEL_DEFAULT_N_MELS);
+        printf("  --fmin <hz>            Lowest mel band edge (default: 0)\n");
+        printf("  --fmax <hz>            Highest mel band edge (default: Nyquist)\n");
+        printf("  --stats                Write per-file RMS, zero-crossing rate, spectral centroid\n");
+        printf("                         and MFCC statistics as .npy columns in stats/\n");
+        printf("  --n-mfcc <n>           MFCCs in the statistics (default: %d)\n", MEL_DEFAULT_N_MFCC);
+        printf("  --vad <dBFS>           Trim leading and trailing silence below this level before\n");
+        printf("                         truncating to the maximum duration (e.g. -40)\n");
+        printf("  --vad-hangover <ms>    Silence kept next to the audio when trimming (default: %d)\n",
+               VAD_DEFAULT_HANGOVER_MS);
+        printf("  --segment              Cut each file into clips of the maximum duration, written\n");
+        printf("                         as <name>_0000.wav, <name>_0001.wav, ...\n");
+        printf("  --segment-overlap <sec>\n");
+        printf("                         Overlap between consecutive clips (default: 0)\n");
         return 1;
     }
     
@@ -457,11 +4550,30 @@ int main(int argc, char **argv) {
     ProcessorConfig config = {
         .target_sample_rate = 16000,
         .min_duration_sec = 3.0f,
-        .max_duration_sec = 5.0f
+        .max_duration_sec = 5.0f,
+        .use_decimator = 1,
+        .split_sec = SPLIT_DEFAULT_SEC,
+        .bitrate = OPUS_DEFAULT_BITRATE,
+        .mel = {
+            .n_fft = MEL_DEFAULT_N_FFT,
+            .hop = MEL_DEFAULT_HOP,
+            .n_mels = MEL_DEFAULT_N_MELS,
+            .n_mfcc = MEL_DEFAULT_N_MFCC
+        },
+        .vad = { .hangover_ms = VAD_DEFAULT_HANGOVER_MS }
     };
     
     int num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
     if (num_threads < 1) num_threads = 4;
+    int use_io_uring = 0;
+    int incremental = -1;
+    int resume = 0;
+    int use_journal = 0;
+    int pack = 0;
+    uint64_t tar_limit = 0;
+    int npy_channels = 0;
+    ScheduleMode schedule = SCHEDULE_SIZE;
+    int stage_threads[PIPELINE_STAGES] = {0};
     
     for (int i = 3; i < argc; i++) {
         if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc) {
@@ -472,65 +4584,403 @@ int main(int argc, char **argv) {
             config.max_duration_sec = atof(argv[++i]);
         } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
             num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-decimator") == 0) {
+            config.use_decimator = 0;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (sample_format_parse(argv[++i], &config.sample_format) < 0) {
+                fprintf(stderr, "Invalid format '%s', expected f32, s16, s24 or ulaw\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--codec") == 0 && i + 1 < argc) {
+            const char *codec = argv[++i];
+            if (strcmp(codec, "wav") == 0) config.codec = OUTPUT_WAV;
+            else if (strcmp(codec, "flac") == 0) config.codec = OUTPUT_FLAC;
+            else if (strcmp(codec, "opus") == 0) config.codec = OUTPUT_OPUS;
+            else {
+                fprintf(stderr, "Invalid codec '%s', expected wav, flac or opus\n", codec);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bitrate") == 0 && i + 1 < argc) {
+            config.bitrate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            config.use_mmap = 1;
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            use_io_uring = 1;
+        } else if (strcmp(argv[i], "--split-sec") == 0 && i + 1 < argc) {
+            config.split_sec = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            output_cache.dir = argv[++i];
+        } else if (strcmp(argv[i], "--journal") == 0) {
+            use_journal = 1;
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = 1;
+            use_journal = 1;
+        } else if (strcmp(argv[i], "--pack") == 0) {
+            pack = 1;
+        } else if (strcmp(argv[i], "--tar-shards") == 0 && i + 1 < argc) {
+            double mb = atof(argv[++i]);
+            if (mb <= 0) {
+                fprintf(stderr, "Invalid tar shard size '%s', expected megabytes\n", argv[i]);
+                return 1;
+            }
+            pack = 1;
+            tar_limit = (uint64_t)(mb * 1024 * 1024);
+        } else if (strcmp(argv[i], "--npy") == 0 && i + 1 < argc) {
+            npy_channels = atoi(argv[++i]);
+            if (npy_channels < 1) {
+                fprintf(stderr, "Invalid channel count '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--mel") == 0) {
+            config.features = FEATURES_WITH_AUDIO;
+        } else if (strcmp(argv[i], "--mel-only") == 0) {
+            config.features = FEATURES_ONLY;
+        } else if (strcmp(argv[i], "--n-fft") == 0 && i + 1 < argc) {
+            config.mel.n_fft = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hop") == 0 && i + 1 < argc) {
+            config.mel.hop = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--n-mels") == 0 && i + 1 < argc) {
+            config.mel.n_mels = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fmin") == 0 && i + 1 < argc) {
+            config.mel.fmin = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--fmax") == 0 && i + 1 < argc) {
+            config.mel.fmax = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            config.stats = 1;
+        } else if (strcmp(argv[i], "--n-mfcc") == 0 && i + 1 < argc) {
+            config.mel.n_mfcc = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--vad") == 0 && i + 1 < argc) {
+            config.vad.threshold_db = atof(argv[++i]);
+            if (config.vad.threshold_db >= 0) {
+                fprintf(stderr, "Invalid VAD threshold '%s', expected dBFS below 0\n", argv[i]);
+                return 1;
+            }
+            config.trim_silence = 1;
+        } else if (strcmp(argv[i], "--segment") == 0) {
+            config.segment = 1;
+        } else if (strcmp(argv[i], "--segment-overlap") == 0 && i + 1 < argc) {
+            config.segment_overlap_sec = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--vad-hangover") == 0 && i + 1 < argc) {
+            config.vad.hangover_ms = atoi(argv[++i]);
+            if (config.vad.hangover_ms < 0) {
+                fprintf(stderr, "Invalid VAD hangover '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--incremental") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "input") == 0) incremental = 0;
+            else if (strcmp(mode, "config") == 0) incremental = 1;
+            else {
+                fprintf(stderr, "Invalid incremental mode '%s', expected input or config\n", mode);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc) {
+            const char *spec = argv[++i];
+            if (sscanf(spec, "%d:%d:%d", &stage_threads[0], &stage_threads[1], &stage_threads[2]) != 3 ||
+                stage_threads[0] < 1 || stage_threads[1] < 1 || stage_threads[2] < 1) {
+                fprintf(stderr, "Invalid pipeline '%s', expected <decode>:<resample>:<write> threads\n", spec);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "readdir") == 0) schedule = SCHEDULE_READDIR;
+            else if (strcmp(mode, "size") == 0) schedule = SCHEDULE_SIZE;
+            else if (strcmp(mode, "duration") == 0) schedule = SCHEDULE_DURATION;
+            else if (strcmp(mode, "stream") == 0) schedule = SCHEDULE_STREAM;
+            else {
+                fprintf(stderr, "Invalid schedule '%s', expected size, duration, readdir or stream\n", mode);
+                return 1;
+            }
+        }
+    }
+    
+    // Packed outputs have no per-file state for these to work with
+    if ((pack || npy_channels) && (stage_threads[0] > 0 || use_journal || incremental >= 0 || output_cache.dir)) {
+        fprintf(stderr, "--pack, --tar-shards and --npy cannot be combined with --pipeline, --journal, "
+                "--resume, --incremental or --cache-dir\n");
+        return 1;
+    }
+    if (config.codec != OUTPUT_WAV) {
+        uint32_t rate = config.target_sample_rate;
+        if (pack || npy_channels || stage_threads[0] > 0) {
+            fprintf(stderr, "--codec %s writes one file per input and cannot be combined with --pack, "
+                    "--tar-shards, --npy or --pipeline\n", config.codec == OUTPUT_FLAC ? "flac" : "opus");
+            return 1;
+        }
+        if (config.codec == OUTPUT_FLAC && config.sample_format == SAMPLE_FORMAT_ULAW) {
+            fprintf(stderr, "FLAC output supports --format s16 or s24\n");
+            return 1;
+        }
+        if (config.codec == OUTPUT_OPUS && (config.sample_format != SAMPLE_FORMAT_F32 || config.bitrate <= 0 ||
+            (rate != 8000 && rate != 12000 && rate != 16000 && rate != 24000 && rate != 48000))) {
+            fprintf(stderr, "Opus output needs a sample rate of 8, 12, 16, 24 or 48 kHz, a positive "
+                    "--bitrate and no --format\n");
+            return 1;
+        }
+    }
+    if ((npy_channels || (pack && !tar_limit)) && config.sample_format != SAMPLE_FORMAT_F32) {
+        fprintf(stderr, "--pack and --npy write float32 only\n");
+        return 1;
+    }
+    if (npy_channels && (pack || schedule == SCHEDULE_STREAM)) {
+        fprintf(stderr, "--npy needs every file up front and cannot be combined with --pack, "
+                "--tar-shards or --schedule stream\n");
+        return 1;
+    }
+    if (config.features && (pack || npy_channels || stage_threads[0] > 0 || output_cache.dir)) {
+        fprintf(stderr, "--mel and --mel-only cannot be combined with --pack, --tar-shards, --npy, "
+                "--pipeline or --cache-dir\n");
+        return 1;
+    }
+    if (config.segment) {
+        float hop_sec = config.max_duration_sec - config.segment_overlap_sec;
+        if (config.segment_overlap_sec < 0 || hop_sec * config.target_sample_rate < 1) {
+            fprintf(stderr, "--segment-overlap must be at least 0 and below --max-duration\n");
+            return 1;
+        }
+        // Each of these assumes one output per input
+        if (npy_channels || stage_threads[0] > 0 || incremental >= 0 || output_cache.dir) {
+            fprintf(stderr, "--segment cannot be combined with --npy, --pipeline, --incremental or "
+                    "--cache-dir\n");
+            return 1;
+        }
+        // The gate holds a silence until it knows whether audio follows. One
+        // clip of it is all a truncated output can use, but every clip after
+        // it would need the whole silence, however long, held in memory.
+        if (config.trim_silence) {
+            fprintf(stderr, "--segment cannot be combined with --vad\n");
+            return 1;
+        }
+    }
+    // The pipeline's decoder stops after max_duration of input
+    if (config.trim_silence && stage_threads[0] > 0) {
+        fprintf(stderr, "--vad cannot be combined with --pipeline\n");
+        return 1;
+    }
+    // Statistics need every file processed in this run
+    if (config.stats && (stage_threads[0] > 0 || output_cache.dir || resume || incremental >= 0)) {
+        fprintf(stderr, "--stats cannot be combined with --pipeline, --cache-dir, --resume or --incremental\n");
+        return 1;
+    }
+    if (config.features || config.stats) {
+        // Builds the shared tables up front, so workers only look them up
+        if (!mel_tables_get(config.target_sample_rate, &config.mel)) {
+            fprintf(stderr, "Invalid mel settings: --n-fft must be a power of two of at least 8, "
+                    "--hop at most --n-fft, --n-mfcc at most --n-mels and --fmin < --fmax <= %u Hz\n",
+                    config.target_sample_rate / 2);
+            return 1;
+        }
+        if (config.features == FEATURES_ONLY && config.codec != OUTPUT_WAV) {
+            fprintf(stderr, "--mel-only writes no audio, ignoring --codec\n");
+            config.codec = OUTPUT_WAV;
         }
     }
     
+    // Each worker's encoder gets that worker's share of the cores
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    config.encoder_threads = num_threads > 0 && cpus > num_threads ? cpus / num_threads : 1;
+    
     printf("Audio Dataset Preprocessor (C)\n");
     printf("Input:  %s\n", input_dir);
     printf("Output: %s\n", output_dir);
     printf("Target sample rate: %u Hz\n", config.target_sample_rate);
     printf("Duration range: %.1fs - %.1fs\n", config.min_duration_sec, config.max_duration_sec);
+    if (config.use_decimator) printf("Decimator kernel: %s\n", decimator_kernel_name());
+    if (config.codec == OUTPUT_OPUS) {
+        printf("Output format: opus, %d bps\n", config.bitrate);
+    } else if (config.codec == OUTPUT_FLAC) {
+        // FLAC has no float samples, so f32 is stored as dithered s16
+        printf("Output format: flac, %s\n", config.sample_format == SAMPLE_FORMAT_S24 ? "s24" : "s16");
+    } else if (config.sample_format == SAMPLE_FORMAT_S16) {
+        printf("Output format: s16 (%s kernel)\n", sample_convert_kernel_name());
+    } else {
+        printf("Output format: %s\n", sample_format_name(config.sample_format));
+    }
+    if (config.features) {
+        printf("Log-mel features: n_fft %d, hop %d, %d bands (%s FFT)%s\n", config.mel.n_fft, config.mel.hop,
+               config.mel.n_mels, mel_kernel_name(), config.features == FEATURES_ONLY ? ", no audio" : "");
+    }
+    if (config.stats) printf("Feature statistics: RMS, ZCR, centroid, %d MFCCs\n", config.mel.n_mfcc);
+    if (config.trim_silence) {
+        printf("Silence trimming: below %.1f dBFS, %d ms hangover\n", config.vad.threshold_db,
+               config.vad.hangover_ms);
+    }
+    if (config.segment) {
+        printf("Segmenting: %.1fs clips every %.1fs\n", config.max_duration_sec,
+               config.max_duration_sec - config.segment_overlap_sec);
+    }
+    
+    ensure_dir(output_dir);
+    if (use_journal && journal_open(output_dir, resume) < 0) {
+        fprintf(stderr, "Could not open the journal in %s, the run cannot be resumed\n", output_dir);
+    }
+    if (incremental >= 0 && manifest_load(output_dir, &config, incremental) < 0) {
+        fprintf(stderr, "Could not read the manifest in %s, processing every file\n", output_dir);
+    }
+    if (config.stats) stats_open(output_dir, input_dir, config.mel.n_mfcc);
+    if (output_cache.dir) {
+        ensure_dir(output_cache.dir);
+        output_cache.config_hash = config_hash(&config);
+    }
     
-    // Collect files
     ProcessTask *tasks = NULL;
     int task_count = 0;
-    int capacity = 0;
-    
-    collect_files_recursive(input_dir, "", output_dir, &config, &tasks, &task_count, &capacity);
-    
-    printf("Found %d audio files\n", task_count);
-    
-    if (task_count == 0) {
-        printf("No audio files found.\n");
-        return 0;
-    }
+    int stream = schedule == SCHEDULE_STREAM;
+    Discovery discovery = {
+        .input_dir = input_dir,
+        .output_dir = output_dir,
+        .config = &config,
+        .walk_threads = num_threads
+    };
     
-    // Create output directories
-    for (int i = 0; i < task_count; i++) {
-        char *dir = strdup(tasks[i].output_path);
-        char *last_slash = strrchr(dir, '/');
-        if (last_slash) {
-            *last_slash = '\0';
-            ensure_dir(dir);
+    if (!stream) {
+        // Collect files
+        TaskList list = {0};
+        if (walk_tree(input_dir, output_dir, &config, num_threads, schedule != SCHEDULE_READDIR,
+                      task_list_add, &list) == AVERROR_EXIT) {
+            fprintf(stderr, "Out of memory, stopped scanning %s\n", input_dir);
+        }
+        tasks = list.tasks;
+        task_count = list.count;
+        
+        printf("Found %d audio files\n", task_count);
+        if (manifest.enabled) printf("Skipped %lu up-to-date files\n", atomic_load(&manifest.skipped));
+        if (resume) printf("Skipped %lu files completed before\n", atomic_load(&journal.resumed));
+        
+        if (task_count == 0) {
+            printf(manifest.skipped || journal.resumed ? "Nothing to do.\n" : "No audio files found.\n");
+            journal_close();
+            manifest_save();
+            manifest_destroy();
+            return 0;
+        }
+        
+        if (npy_channels) {
+            float max_sec = config.max_duration_sec > config.min_duration_sec ?
+                config.max_duration_sec : config.min_duration_sec;
+            uint64_t frames = (uint64_t)(max_sec * config.target_sample_rate);
+            if (npy_open(output_dir, input_dir, tasks, task_count, npy_channels, frames) < 0) {
+                fprintf(stderr, "Failed to create %s/%s\n", output_dir, NPY_DATA_NAME);
+                return 1;
+            }
+        }
+        
+        // Create output directories
+        for (int i = 0; i < task_count && !pack && !npy_channels; i++) {
+            char *dir = strdup(tasks[i].output_path);
+            char *last_slash = strrchr(dir, '/');
+            if (last_slash) {
+                *last_slash = '\0';
+                ensure_dir(dir);
+            }
+            free(dir);
         }
-        free(dir);
+        
+        schedule_tasks(tasks, task_count, schedule);
     }
     
-    if (num_threads > task_count) num_threads = task_count;
-    printf("Processing with %d threads...\n", num_threads);
-    
-    // Thread pool
+    long seed_chunk = schedule == SCHEDULE_READDIR ? SCHEDULE_READDIR_CHUNK : 1;
+    int use_pipeline = stage_threads[0] > 0;
     ThreadPool pool = {
         .tasks = tasks,
-        .task_count = task_count,
-        .next_task = 0
+        .task_count = task_count
     };
-    pthread_mutex_init(&pool.mutex, NULL);
+    Pipeline pipeline = {0};
+    pthread_t *threads = NULL;
     
-    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
-    for (int i = 0; i < num_threads; i++) {
-        pthread_create(&threads[i], NULL, worker_thread, &pool);
+    if (use_pipeline) {
+        if (!stream && stage_threads[0] > task_count) stage_threads[0] = task_count;
+        memcpy(pipeline.threads, stage_threads, sizeof(stage_threads));
+        printf("Processing with a %d:%d:%d decode:resample:write pipeline...\n",
+               stage_threads[0], stage_threads[1], stage_threads[2]);
+        if (use_io_uring) fprintf(stderr, "--io-uring is not used in pipeline mode\n");
+        
+        int started = stream ? discovery_start(&discovery, &pipeline.sched, stage_threads[0]) :
+            seed_tasks(&pipeline.sched, tasks, task_count, stage_threads[0], seed_chunk);
+        if (started < 0 || pipeline_run(&pipeline) < 0) {
+            fprintf(stderr, "Failed to start pipeline\n");
+            return 1;
+        }
+    } else {
+        if (!stream && num_threads > task_count) num_threads = task_count;
+        pool.num_threads = num_threads;
+        printf("Processing with %d threads...\n", num_threads);
+        
+        if (pack && pack_open(output_dir, input_dir, num_threads, tar_limit) < 0) {
+            fprintf(stderr, "Failed to create the pack shards in %s\n", output_dir);
+            return 1;
+        }
+        
+        atomic_init(&pool.next_worker, 0);
+        int started = stream ? discovery_start(&discovery, &pool.sched, num_threads) :
+            seed_tasks(&pool.sched, tasks, task_count, num_threads, seed_chunk);
+        if (started < 0) {
+            fprintf(stderr, "Failed to allocate scheduler\n");
+            return 1;
+        }
+        
+        if (use_io_uring) {
+            pool.io = io_engine_create(IO_QUEUE_DEPTH, IO_PREFETCH_BUDGET);
+            pool.prefetch_window = 2;
+            if (!pool.io) fprintf(stderr, "io_uring unavailable, using synchronous I/O\n");
+        }
+        
+        threads = malloc(num_threads * sizeof(pthread_t));
+        for (int i = 0; i < num_threads; i++) {
+            pthread_create(&threads[i], NULL, worker_thread, &pool);
+        }
+        
+        for (int i = 0; i < num_threads; i++) {
+            pthread_join(threads[i], NULL);
+        }
     }
     
-    for (int i = 0; i < num_threads; i++) {
-        pthread_join(threads[i], NULL);
+    if (stream) {
+        // Every worker has exited, so the walk is over too
+        discovery_join(&discovery);
+        printf("Found %ld audio files\n", discovery.found);
+        if (manifest.enabled) printf("Skipped %lu up-to-date files\n", atomic_load(&manifest.skipped));
+        if (resume) printf("Skipped %lu files completed before\n", atomic_load(&journal.resumed));
     }
     
+    journal_close();
+    if (pack) {
+        long packed = pack_close();
+        if (packed < 0) fprintf(stderr, "Failed to write %s/%s\n", output_dir, PACK_INDEX_NAME);
+        else printf("Packed %ld files into %d shards\n", packed, atomic_load(&pack_output.files));
+    }
+    if (npy_channels) {
+        long filled = npy_close();
+        if (filled < 0) fprintf(stderr, "Failed to write %s/%s\n", output_dir, NPY_LENGTHS_NAME);
+        else printf("Wrote %ld of %d rows to %s\n", filled, task_count, NPY_DATA_NAME);
+    }
+    if (config.stats) {
+        long rows = stats_close();
+        if (rows < 0) fprintf(stderr, "Failed to write the statistics in %s/%s\n", output_dir, STATS_DIR_NAME);
+        else printf("Wrote statistics of %ld files to %s/\n", rows, STATS_DIR_NAME);
+    }
     printf("Processing complete!\n");
+    printf("Resampler cache: %lu hits, %lu misses\n",
+           atomic_load(&swr_cache.hits), atomic_load(&swr_cache.misses));
+    if (output_cache.dir) {
+        printf("Output cache: %lu hits, %lu misses, %lu stored\n", atomic_load(&output_cache.hits),
+               atomic_load(&output_cache.misses), atomic_load(&output_cache.stores));
+    }
+    if (use_pipeline) {
+        pipeline_report(&pipeline);
+    } else {
+        printf("Work stealing: %lu steals\n", atomic_load(&pool.sched.steals));
+        io_engine_report(pool.io);
+    }
+    if (manifest_save() < 0) fprintf(stderr, "Failed to write %s\n", manifest.path);
     
     // Cleanup
     free(threads);
-    pthread_mutex_destroy(&pool.mutex);
+    pipeline_destroy(&pipeline);
+    work_scheduler_destroy(&pool.sched);
+    io_engine_destroy(pool.io);
+    swr_cache_destroy();
+    manifest_destroy();
     for (int i = 0; i < task_count; i++) {
         free(tasks[i].input_path);
         free(tasks[i].output_path);
@@ -0,0 +1,178 @@
+// Compares the integer-ratio FIR decimator against libswresample configured
+// the way audio_preprocessor does (filter_size=64, cutoff=0.97).
+//
+// Usage: ./bench_decimate [seconds] [channels] [in_rate] [out_rate]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libavutil/opt.h>
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+
+#include "decimator.h"
+
+#define BLOCK_SIZE 1152
+#define RUNS 3
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Tones across the passband and above the output Nyquist plus white noise
+static void generate_input(float **planes, int channels, size_t n, int rate) {
+    uint32_t seed = 12345;
+    for (int c = 0; c < channels; c++) {
+        for (size_t i = 0; i < n; i++) {
+            double t = (double)i / rate;
+            seed = seed * 1664525u + 1013904223u;
+            double noise = ((seed >> 8) / 16777216.0 - 0.5) * 0.05;
+            planes[c][i] = (float)(0.3 * sin(2 * M_PI * (440.0 + 100 * c) * t) +
+                                   0.2 * sin(2 * M_PI * 3000.0 * t) +
+                                   0.1 * sin(2 * M_PI * 11000.0 * t) + noise);
+        }
+    }
+}
+
+static size_t run_swr(float **planes, int channels, size_t n, int in_rate, int out_rate, float *out) {
+    SwrContext *swr = NULL;
+    AVChannelLayout layout = {0};
+    av_channel_layout_default(&layout, channels);
+    
+    if (swr_alloc_set_opts2(&swr, &layout, AV_SAMPLE_FMT_FLT, out_rate,
+                            &layout, AV_SAMPLE_FMT_FLTP, in_rate, 0, NULL) < 0) return 0;
+    av_opt_set_int(swr, "filter_size", 64, 0);
+    av_opt_set_double(swr, "cutoff", 0.97, 0);
+    if (swr_init(swr) < 0) { swr_free(&swr); return 0; }
+    
+    size_t total = 0;
+    const uint8_t *in[channels];
+    for (size_t off = 0; off < n; off += BLOCK_SIZE) {
+        int len = n - off < BLOCK_SIZE ? (int)(n - off) : BLOCK_SIZE;
+        for (int c = 0; c < channels; c++) in[c] = (const uint8_t *)(planes[c] + off);
+        
+        uint8_t *dst = (uint8_t *)(out + total * channels);
+        int got = swr_convert(swr, &dst, BLOCK_SIZE, in, len);
+        if (got > 0) total += got;
+    }
+    
+    int got;
+    do {
+        uint8_t *dst = (uint8_t *)(out + total * channels);
+        got = swr_convert(swr, &dst, BLOCK_SIZE, NULL, 0);
+        if (got > 0) total += got;
+    } while (got > 0);
+    
+    swr_free(&swr);
+    return total;
+}
+
+static size_t run_decimator(float **planes, int channels, size_t n, int factor, float *out) {
+    Decimator d;
+    if (decimator_init(&d, factor, channels, 64, 0.97) < 0) return 0;
+    
+    size_t total = 0;
+    float *in[channels];
+    for (size_t off = 0; off < n; off += BLOCK_SIZE) {
+        size_t len = n - off < BLOCK_SIZE ? n - off : BLOCK_SIZE;
+        decimator_get_input(&d, len, in);
+        for (int c = 0; c < channels; c++) memcpy(in[c], planes[c] + off, len * sizeof(float));
+        
+        size_t got;
+        while ((got = decimator_process(&d, len, out + total * channels, BLOCK_SIZE)) > 0) {
+            total += got;
+            len = 0;
+        }
+    }
+    
+    size_t got;
+    while ((got = decimator_flush(&d, out + total * channels, BLOCK_SIZE)) > 0) total += got;
+    
+    decimator_free(&d);
+    return total;
+}
+
+// SNR of b against a on channel 0, searching a few samples of lag
+static double compare(const float *a, size_t na, const float *b, size_t nb, int channels, int *best_lag) {
+    size_t n = na < nb ? na : nb;
+    double best = -1.0;
+    
+    for (int lag = -8; lag <= 8; lag++) {
+        double sig = 0.0, err = 0.0;
+        for (size_t i = 64; i + 64 < n; i++) {
+            long j = (long)i + lag;
+            if (j < 0 || (size_t)j >= n) continue;
+            double x = a[i * channels];
+            double e = x - b[j * channels];
+            sig += x * x;
+            err += e * e;
+        }
+        double snr = err > 0 ? 10.0 * log10(sig / err) : 300.0;
+        if (snr > best) {
+            best = snr;
+            *best_lag = lag;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 600.0;
+    int channels = argc > 2 ? atoi(argv[2]) : 2;
+    int in_rate = argc > 3 ? atoi(argv[3]) : 48000;
+    int out_rate = argc > 4 ? atoi(argv[4]) : 16000;
+    
+    int factor = decimator_factor(in_rate, out_rate);
+    if (!factor) {
+        fprintf(stderr, "%d -> %d is not a supported integer ratio\n", in_rate, out_rate);
+        return 1;
+    }
+    
+    size_t n = (size_t)(seconds * in_rate);
+    size_t out_cap = n / factor + 2 * BLOCK_SIZE;
+    
+    float **planes = malloc(channels * sizeof(float *));
+    for (int c = 0; c < channels; c++) planes[c] = malloc(n * sizeof(float));
+    float *out_swr = malloc(out_cap * channels * sizeof(float));
+    float *out_dec = malloc(out_cap * channels * sizeof(float));
+    
+    generate_input(planes, channels, n, in_rate);
+    
+    printf("Input: %.0fs, %d channels, %d -> %d Hz (factor %d)\n",
+           seconds, channels, in_rate, out_rate, factor);
+    printf("Decimator kernel: %s\n\n", decimator_kernel_name());
+    
+    double best_swr = 1e30, best_dec = 1e30;
+    size_t n_swr = 0, n_dec = 0;
+    
+    for (int run = 0; run < RUNS; run++) {
+        double t0 = now_sec();
+        n_swr = run_swr(planes, channels, n, in_rate, out_rate, out_swr);
+        double t1 = now_sec();
+        n_dec = run_decimator(planes, channels, n, factor, out_dec);
+        double t2 = now_sec();
+        
+        if (t1 - t0 < best_swr) best_swr = t1 - t0;
+        if (t2 - t1 < best_dec) best_dec = t2 - t1;
+    }
+    
+    printf("%-10s %10s %12s %12s\n", "path", "time", "x realtime", "out frames");
+    printf("%-10s %9.3fs %11.0fx %12zu\n", "swr", best_swr, seconds / best_swr, n_swr);
+    printf("%-10s %9.3fs %11.0fx %12zu\n", "decimator", best_dec, seconds / best_dec, n_dec);
+    printf("\nSpeedup: %.2fx\n", best_swr / best_dec);
+    
+    int lag = 0;
+    double snr = compare(out_swr, n_swr, out_dec, n_dec, channels, &lag);
+    printf("Decimator vs swr: %.1f dB SNR (lag %d)\n", snr, lag);
+    
+    for (int c = 0; c < channels; c++) free(planes[c]);
+    free(planes);
+    free(out_swr);
+    free(out_dec);
+    return 0;
+}
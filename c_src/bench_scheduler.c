@@ -0,0 +1,190 @@
+// Measures per-task scheduling overhead with tiny synthetic tasks: the
+// mutex-guarded counter the pool used to have, a bare atomic counter, and
+// the work-stealing scheduler. A final run lets every task spawn children
+// onto its worker's own deque, which a shared counter cannot express.
+//
+// Usage: ./bench_scheduler [tasks] [threads] [work]
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "scheduler.h"
+
+#define RUNS 5
+#define FANOUT 4
+
+typedef struct {
+    long task_count;
+    int work;
+    
+    pthread_mutex_t mutex;
+    long next_task;
+    atomic_long next_atomic;
+    
+    WorkScheduler sched;
+    atomic_int next_worker;
+    int spawn_depth;
+    
+    atomic_ulong checksum;
+} Bench;
+
+// Items pushed by the fan-out run carry their depth in the pointer value
+#define ITEM_DEPTH(item) ((int)((uintptr_t)(item) >> 1))
+#define DEPTH_ITEM(depth) ((void *)(((uintptr_t)(depth) << 1) | 1))
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A few nanoseconds of arithmetic the compiler cannot drop
+static uint64_t run_task(uint64_t id, int work) {
+    uint64_t x = id * 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < work; i++) x = (x ^ (x >> 31)) * 0xBF58476D1CE4E5B9ull;
+    return x;
+}
+
+static void *mutex_worker(void *arg) {
+    Bench *b = arg;
+    uint64_t sum = 0;
+    
+    while (1) {
+        pthread_mutex_lock(&b->mutex);
+        long idx = b->next_task++;
+        pthread_mutex_unlock(&b->mutex);
+        
+        if (idx >= b->task_count) break;
+        sum += run_task(idx, b->work);
+    }
+    
+    atomic_fetch_add(&b->checksum, sum);
+    return NULL;
+}
+
+static void *atomic_worker(void *arg) {
+    Bench *b = arg;
+    uint64_t sum = 0;
+    
+    while (1) {
+        long idx = atomic_fetch_add_explicit(&b->next_atomic, 1, memory_order_relaxed);
+        if (idx >= b->task_count) break;
+        sum += run_task(idx, b->work);
+    }
+    
+    atomic_fetch_add(&b->checksum, sum);
+    return NULL;
+}
+
+static void *steal_worker(void *arg) {
+    Bench *b = arg;
+    int worker = atomic_fetch_add(&b->next_worker, 1);
+    uint64_t sum = 0;
+    void *item;
+    
+    while ((item = work_scheduler_next(&b->sched, worker))) {
+        if ((uintptr_t)item & 1) {
+            int depth = ITEM_DEPTH(item);
+            if (depth < b->spawn_depth) {
+                for (int i = 0; i < FANOUT; i++) {
+                    work_scheduler_push(&b->sched, worker, DEPTH_ITEM(depth + 1));
+                }
+            }
+            sum += run_task(depth, b->work);
+        } else {
+            sum += run_task(((uintptr_t)item >> 1) - 1, b->work);
+        }
+        work_scheduler_done(&b->sched);
+    }
+    
+    atomic_fetch_add(&b->checksum, sum);
+    return NULL;
+}
+
+static double run_threads(Bench *b, int threads, void *(*fn)(void *)) {
+    pthread_t tids[threads];
+    double t0 = now_sec();
+    for (int i = 0; i < threads; i++) pthread_create(&tids[i], NULL, fn, b);
+    for (int i = 0; i < threads; i++) pthread_join(tids[i], NULL);
+    return now_sec() - t0;
+}
+
+static double bench_counter(Bench *b, int threads, int use_mutex) {
+    double best = 1e30;
+    for (int run = 0; run < RUNS; run++) {
+        b->next_task = 0;
+        atomic_store(&b->next_atomic, 0);
+        double t = run_threads(b, threads, use_mutex ? mutex_worker : atomic_worker);
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+static double bench_steal(Bench *b, int threads, void **items, long count, int spawn_depth,
+                          unsigned long *steals) {
+    double best = 1e30;
+    for (int run = 0; run < RUNS; run++) {
+        if (work_scheduler_init(&b->sched, threads) < 0 ||
+            work_scheduler_seed(&b->sched, items, count, 1) < 0) {
+            fprintf(stderr, "Failed to allocate scheduler\n");
+            exit(1);
+        }
+        atomic_store(&b->next_worker, 0);
+        b->spawn_depth = spawn_depth;
+        
+        double t = run_threads(b, threads, steal_worker);
+        if (t < best) {
+            best = t;
+            *steals = atomic_load(&b->sched.steals);
+        }
+        work_scheduler_destroy(&b->sched);
+    }
+    return best;
+}
+
+static void print_row(const char *name, double t, long tasks, unsigned long steals) {
+    printf("%-16s %9.3fs %10.1f %12lu\n", name, t, t * 1e9 / tasks, steals);
+}
+
+int main(int argc, char **argv) {
+    long task_count = argc > 1 ? atol(argv[1]) : 4000000;
+    int threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int work = argc > 3 ? atoi(argv[3]) : 8;
+    if (threads < 1) threads = 1;
+    
+    Bench b = { .task_count = task_count, .work = work };
+    pthread_mutex_init(&b.mutex, NULL);
+    
+    void **items = malloc(task_count * sizeof(void *));
+    for (long i = 0; i < task_count; i++) items[i] = (void *)((uintptr_t)(i + 1) << 1);
+    
+    printf("Tasks: %ld, threads: %d, work: %d rounds per task\n\n", task_count, threads, work);
+    printf("%-16s %10s %10s %12s\n", "scheduler", "time", "ns/task", "steals");
+    
+    unsigned long steals = 0;
+    print_row("mutex counter", bench_counter(&b, threads, 1), task_count, 0);
+    print_row("atomic counter", bench_counter(&b, threads, 0), task_count, 0);
+    print_row("work stealing", bench_steal(&b, threads, items, task_count, 0, &steals),
+              task_count, steals);
+    
+    // One root per thread, each spawning FANOUT children per level
+    int depth = 0;
+    long spawned = threads;
+    for (long level = threads; spawned + level * FANOUT <= task_count; depth++) {
+        level *= FANOUT;
+        spawned += level;
+    }
+    for (int i = 0; i < threads; i++) items[i] = DEPTH_ITEM(0);
+    double t = bench_steal(&b, threads, items, threads, depth, &steals);
+    printf("\nFan-out (%d levels, %ld tasks spawned by workers):\n", depth, spawned);
+    print_row("work stealing", t, spawned, steals);
+    
+    pthread_mutex_destroy(&b.mutex);
+    free(items);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "cpu_dispatch.h"
+
+#include <pthread.h>
+
+static pthread_once_t features_once = PTHREAD_ONCE_INIT;
+static unsigned features;
+
+static void detect_features(void) {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) features |= CPU_AVX2;
+    if (__builtin_cpu_supports("fma")) features |= CPU_FMA;
+#endif
+}
+
+unsigned cpu_features(void) {
+    pthread_once(&features_once, detect_features);
+    return features;
+}
+
+const CpuKernel *cpu_dispatch(CpuDispatch *d) {
+    const CpuKernel *k = atomic_load_explicit(&d->chosen, memory_order_acquire);
+    if (k) return k;
+    
+    // Threads racing here all pick the same option
+    unsigned have = cpu_features();
+    for (k = d->options; k->requires & ~have; k++) {
+    }
+    atomic_store_explicit(&d->chosen, k, memory_order_release);
+    return k;
+}
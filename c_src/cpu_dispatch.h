@@ -0,0 +1,31 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+#include <stdatomic.h>
+
+// Runtime kernel selection shared by the SIMD modules. Each module lists
+// its kernels best first with the CPU features they need; the first one
+// the running CPU supports is chosen on first use and published through an
+// atomic pointer, so any number of threads may ask concurrently.
+#define CPU_AVX2 1u
+#define CPU_FMA 2u
+
+typedef void (*CpuKernelFn)(void);
+
+typedef struct {
+    CpuKernelFn kernel;         // cast back to the module's kernel type
+    const char *name;
+    unsigned requires;          // CPU_* flags; the last option needs none
+} CpuKernel;
+
+typedef struct {
+    const CpuKernel *options;
+    _Atomic(const CpuKernel *) chosen;
+} CpuDispatch;
+
+// CPU_* features of the running CPU, detected once
+unsigned cpu_features(void);
+
+const CpuKernel *cpu_dispatch(CpuDispatch *d);
+
+#endif
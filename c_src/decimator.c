@@ -0,0 +1,259 @@
+#include "decimator.h"
+#include "cpu_dispatch.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define DECIMATOR_TAP_ALIGN 16
+#define DECIMATOR_KAISER_BETA 9.0
+
+typedef float (*DotKernel)(const float *a, const float *b, int n);
+
+// n is always a multiple of DECIMATOR_TAP_ALIGN
+static float dot_scalar(const float *a, const float *b, int n) {
+    float acc[4] = {0};
+    for (int i = 0; i < n; i += 4) {
+        acc[0] += a[i] * b[i];
+        acc[1] += a[i + 1] * b[i + 1];
+        acc[2] += a[i + 2] * b[i + 2];
+        acc[3] += a[i + 3] * b[i + 3];
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+#if defined(__SSE__) || defined(__x86_64__)
+static float dot_sse(const float *a, const float *b, int n) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (int i = 0; i < n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+}
+#define HAVE_DOT_SSE 1
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float *a, const float *b, int n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+#define HAVE_DOT_AVX2 1
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static float dot_neon(const float *a, const float *b, int n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (int i = 0; i < n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1));
+}
+#define HAVE_DOT_NEON 1
+#endif
+
+static const CpuKernel dot_kernels[] = {
+#if defined(HAVE_DOT_AVX2)
+    {(CpuKernelFn)dot_avx2, "avx2", CPU_AVX2 | CPU_FMA},
+#endif
+#if defined(HAVE_DOT_SSE)
+    {(CpuKernelFn)dot_sse, "sse", 0},
+#elif defined(HAVE_DOT_NEON)
+    {(CpuKernelFn)dot_neon, "neon", 0},
+#endif
+    {(CpuKernelFn)dot_scalar, "scalar", 0}
+};
+
+static CpuDispatch dot_dispatch = { .options = dot_kernels };
+
+const char *decimator_kernel_name(void) {
+    return cpu_dispatch(&dot_dispatch)->name;
+}
+
+int decimator_factor(int in_rate, int out_rate) {
+    if (out_rate <= 0 || in_rate <= out_rate || in_rate % out_rate != 0) return 0;
+    
+    int factor = in_rate / out_rate;
+    switch (factor) {
+    case 2: case 3: case 4: case 6:
+        return factor;
+    default:
+        return 0;
+    }
+}
+
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 64; k++) {
+        term *= (x * x) / (4.0 * k * k);
+        sum += term;
+        if (term < sum * 1e-16) break;
+    }
+    return sum;
+}
+
+// Mirrors the phase-0 branch of libswresample's build_filter() for a
+// Kaiser window so both paths attenuate the same band
+static int build_filter(Decimator *d, int filter_size, double cutoff) {
+    double factor = cutoff / d->factor;
+    int tap_count = (int)ceil(filter_size / factor);
+    int center = (tap_count - 1) / 2;
+    
+    d->taps = (tap_count + DECIMATOR_TAP_ALIGN - 1) / DECIMATOR_TAP_ALIGN * DECIMATOR_TAP_ALIGN;
+    d->center = center;
+    d->coeffs = calloc(d->taps, sizeof(float));
+    if (!d->coeffs) return -1;
+    
+    double *tmp = malloc(tap_count * sizeof(double));
+    if (!tmp) return -1;
+    
+    double norm = 0.0;
+    for (int i = 0; i < tap_count; i++) {
+        double x = M_PI * (i - center) * factor;
+        double y = x == 0.0 ? 1.0 : sin(x) / x;
+        double w = 2.0 * x / (factor * tap_count * M_PI);
+        y *= bessel_i0(DECIMATOR_KAISER_BETA * sqrt(fmax(1.0 - w * w, 0.0)));
+        tmp[i] = y;
+        norm += y;
+    }
+    
+    // Applied as a correlation, like swr, with the padding taps left at zero
+    for (int i = 0; i < tap_count; i++) d->coeffs[i] = (float)(tmp[i] / norm);
+    free(tmp);
+    return 0;
+}
+
+int decimator_init(Decimator *d, int factor, int channels, int filter_size, double cutoff) {
+    memset(d, 0, sizeof(*d));
+    d->factor = factor;
+    d->channels = channels;
+    
+    if (build_filter(d, filter_size, cutoff) < 0) goto fail;
+    
+    d->history = calloc(channels, sizeof(float *));
+    if (!d->history) goto fail;
+    
+    decimator_reset(d);
+    return 0;
+
+fail:
+    decimator_free(d);
+    return -1;
+}
+
+void decimator_free(Decimator *d) {
+    if (d->history) {
+        for (int c = 0; c < d->channels; c++) free(d->history[c]);
+        free(d->history);
+    }
+    free(d->coeffs);
+    memset(d, 0, sizeof(*d));
+}
+
+static int ensure_space(Decimator *d, size_t n) {
+    // Drop consumed samples before growing
+    if (d->pos > 0 && d->len + n > d->capacity) {
+        for (int c = 0; c < d->channels; c++) {
+            memmove(d->history[c], d->history[c] + d->pos, (d->len - d->pos) * sizeof(float));
+        }
+        d->len -= d->pos;
+        d->pos = 0;
+    }
+    
+    if (d->len + n <= d->capacity) return 0;
+    
+    size_t capacity = d->capacity ? d->capacity : (size_t)d->taps * 4;
+    while (capacity < d->len + n) capacity *= 2;
+    
+    for (int c = 0; c < d->channels; c++) {
+        float *buf = realloc(d->history[c], capacity * sizeof(float));
+        if (!buf) return -1;
+        d->history[c] = buf;
+    }
+    d->capacity = capacity;
+    return 0;
+}
+
+void decimator_reset(Decimator *d) {
+    d->len = 0;
+    d->pos = 0;
+    d->total_in = 0;
+    d->total_out = 0;
+    d->flushing = 0;
+    
+    // Leading zeros centre the first output window on the first input sample
+    if (ensure_space(d, d->center) < 0) return;
+    for (int c = 0; c < d->channels; c++) {
+        memset(d->history[c], 0, d->center * sizeof(float));
+    }
+    d->len = d->center;
+}
+
+int decimator_get_input(Decimator *d, size_t n, float **ptrs) {
+    if (ensure_space(d, n) < 0) return -1;
+    for (int c = 0; c < d->channels; c++) ptrs[c] = d->history[c] + d->len;
+    return 0;
+}
+
+static size_t produce(Decimator *d, float *out, size_t max_out) {
+    const DotKernel dot_kernel = (DotKernel)cpu_dispatch(&dot_dispatch)->kernel;
+    const int channels = d->channels;
+    const int taps = d->taps;
+    uint64_t limit = UINT64_MAX;
+    size_t n = 0;
+    
+    // Once flushing, stop at ceil(total_in / factor) like the swr path does
+    if (d->flushing) limit = (d->total_in + d->factor - 1) / d->factor;
+    
+    while (n < max_out && d->pos + taps <= d->len && d->total_out < limit) {
+        for (int c = 0; c < channels; c++) {
+            out[n * channels + c] = dot_kernel(d->coeffs, d->history[c] + d->pos, taps);
+        }
+        d->pos += d->factor;
+        d->total_out++;
+        n++;
+    }
+    return n;
+}
+
+size_t decimator_process(Decimator *d, size_t n_in, float *out, size_t max_out) {
+    d->len += n_in;
+    d->total_in += n_in;
+    return produce(d, out, max_out);
+}
+
+size_t decimator_flush(Decimator *d, float *out, size_t max_out) {
+    if (!d->flushing) {
+        float *ptrs[d->channels];
+        size_t pad = d->taps;
+        
+        d->flushing = 1;
+        if (decimator_get_input(d, pad, ptrs) < 0) return 0;
+        for (int c = 0; c < d->channels; c++) memset(ptrs[c], 0, pad * sizeof(float));
+        d->len += pad;
+    }
+    return produce(d, out, max_out);
+}
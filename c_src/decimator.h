@@ -0,0 +1,52 @@
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming FIR decimator for integer sample rate ratios. The filter is
+// designed the same way libswresample builds its polyphase bank (Kaiser
+// windowed sinc, beta 9) so output quality matches the generic path for
+// the same filter_size/cutoff, while the inner dot product runs on
+// SSE/AVX2/NEON.
+typedef struct {
+    int factor;
+    int channels;
+    int taps;           // filter length, padded to a multiple of 16
+    int center;         // input delay of the filter in samples
+    float *coeffs;
+    float **history;    // per-channel input samples not yet consumed
+    size_t capacity;    // allocated samples per channel
+    size_t len;         // valid samples per channel
+    size_t pos;         // start of the next output window
+    uint64_t total_in;
+    uint64_t total_out;
+    int flushing;
+} Decimator;
+
+// Returns the decimation factor if in_rate -> out_rate has a fast path, 0 otherwise
+int decimator_factor(int in_rate, int out_rate);
+
+int decimator_init(Decimator *d, int factor, int channels, int filter_size, double cutoff);
+void decimator_free(Decimator *d);
+
+// Rewinds the stream state for a new input while keeping the filter
+void decimator_reset(Decimator *d);
+
+// Makes room for n more input samples per channel and stores the write
+// position of each channel in ptrs. The samples are consumed by the next
+// decimator_process() call with n_in == n.
+int decimator_get_input(Decimator *d, size_t n, float **ptrs);
+
+// Commits n_in samples written through decimator_get_input() and writes up
+// to max_out interleaved output frames. Call again with n_in == 0 while it
+// returns max_out to drain pending output.
+size_t decimator_process(Decimator *d, size_t n_in, float *out, size_t max_out);
+
+// Emits the filter tail once the input has ended. Call until it returns 0.
+size_t decimator_flush(Decimator *d, float *out, size_t max_out);
+
+// Name of the dot product kernel selected for this CPU
+const char *decimator_kernel_name(void);
+
+#endif
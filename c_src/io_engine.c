@@ -0,0 +1,464 @@
+#include "io_engine.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+void io_completion_init(IoCompletion *c) {
+    pthread_mutex_init(&c->mutex, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    c->pending = 0;
+    c->error = 0;
+}
+
+void io_completion_destroy(IoCompletion *c) {
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->mutex);
+}
+
+int io_completion_wait(IoCompletion *c, int max_pending) {
+    pthread_mutex_lock(&c->mutex);
+    while (c->pending > max_pending) pthread_cond_wait(&c->cond, &c->mutex);
+    int error = c->error;
+    pthread_mutex_unlock(&c->mutex);
+    return error;
+}
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+#include <stdatomic.h>
+
+#define IO_READ_CHUNK (1024 * 1024)
+
+static void io_completion_add(IoCompletion *c, int n) {
+    pthread_mutex_lock(&c->mutex);
+    c->pending += n;
+    pthread_mutex_unlock(&c->mutex);
+}
+
+static void io_completion_finish(IoCompletion *c, int error) {
+    pthread_mutex_lock(&c->mutex);
+    if (error && !c->error) c->error = error;
+    c->pending--;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->mutex);
+}
+
+typedef enum {
+    IO_REQ_READ,
+    IO_REQ_WRITE,
+    IO_REQ_WAKE
+} IoRequestType;
+
+typedef struct {
+    IoRequestType type;
+    IoCompletion *completion;
+    int fd;
+    uint8_t *buf;
+    size_t len;         // bytes still to transfer
+    uint64_t offset;
+    uint8_t *owned;     // freed once the request completes
+} IoRequest;
+
+struct IoEngine {
+    struct io_uring ring;
+    pthread_mutex_t sq_mutex;
+    pthread_t thread;
+    atomic_int stop;
+    
+    // Prefetches waiting for the engine thread to open their file
+    pthread_mutex_t queue_mutex;
+    IoPrefetch *queue_head;
+    IoPrefetch *queue_tail;
+    size_t prefetch_budget;
+    size_t prefetch_used;
+    
+    // Queue statistics
+    pthread_mutex_t stats_mutex;
+    int inflight;
+    int max_inflight;
+    double start_time;
+    double last_change;
+    double busy_time;
+    double depth_area;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Integrates queue depth over time so the report can show utilisation
+static void stats_update(IoEngine *e, int delta) {
+    double now = now_sec();
+    
+    pthread_mutex_lock(&e->stats_mutex);
+    double dt = now - e->last_change;
+    e->depth_area += e->inflight * dt;
+    if (e->inflight > 0) e->busy_time += dt;
+    e->last_change = now;
+    e->inflight += delta;
+    if (e->inflight > e->max_inflight) e->max_inflight = e->inflight;
+    pthread_mutex_unlock(&e->stats_mutex);
+}
+
+static int submit_request(IoEngine *e, IoRequest *req) {
+    pthread_mutex_lock(&e->sq_mutex);
+    
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&e->ring);
+    if (!sqe) {
+        io_uring_submit(&e->ring);
+        sqe = io_uring_get_sqe(&e->ring);
+    }
+    if (!sqe) {
+        pthread_mutex_unlock(&e->sq_mutex);
+        return -EBUSY;
+    }
+    
+    switch (req->type) {
+    case IO_REQ_READ:
+        io_uring_prep_read(sqe, req->fd, req->buf, req->len, req->offset);
+        break;
+    case IO_REQ_WRITE:
+        io_uring_prep_write(sqe, req->fd, req->buf, req->len, req->offset);
+        break;
+    case IO_REQ_WAKE:
+        io_uring_prep_nop(sqe);
+        break;
+    }
+    io_uring_sqe_set_data(sqe, req);
+    
+    int ret = io_uring_submit(&e->ring);
+    pthread_mutex_unlock(&e->sq_mutex);
+    return ret < 0 ? ret : 0;
+}
+
+// Nudges the engine thread out of io_uring_wait_cqe()
+static void wake_engine(IoEngine *e) {
+    IoRequest *req = calloc(1, sizeof(*req));
+    if (!req) return;
+    req->type = IO_REQ_WAKE;
+    if (submit_request(e, req) < 0) free(req);
+}
+
+static void finish_request(IoEngine *e, IoRequest *req, int error) {
+    stats_update(e, -1);
+    io_completion_finish(req->completion, error);
+    free(req->owned);
+    free(req);
+}
+
+static void handle_completion(IoEngine *e, IoRequest *req, int res) {
+    if (req->type == IO_REQ_WAKE) {
+        free(req);
+        return;
+    }
+    
+    if (res == -EAGAIN || res == -EINTR) {
+        res = 0;
+    } else if (res <= 0) {
+        finish_request(e, req, res < 0 ? res : -EIO);
+        return;
+    }
+    
+    pthread_mutex_lock(&e->stats_mutex);
+    if (req->type == IO_REQ_READ) e->bytes_read += res;
+    else e->bytes_written += res;
+    pthread_mutex_unlock(&e->stats_mutex);
+    
+    req->buf += res;
+    req->len -= res;
+    req->offset += res;
+    
+    if (req->len == 0) {
+        finish_request(e, req, 0);
+    } else if (submit_request(e, req) < 0) {
+        // Short transfer that could not be requeued
+        finish_request(e, req, -EIO);
+    }
+}
+
+static int submit_transfer(IoEngine *e, IoRequestType type, IoCompletion *c, int fd,
+                           uint8_t *buf, size_t len, uint64_t offset, uint8_t *owned) {
+    IoRequest *req = calloc(1, sizeof(*req));
+    if (!req) return -ENOMEM;
+    
+    *req = (IoRequest){
+        .type = type, .completion = c, .fd = fd,
+        .buf = buf, .len = len, .offset = offset, .owned = owned
+    };
+    
+    pthread_mutex_lock(&e->stats_mutex);
+    if (type == IO_REQ_READ) e->reads++;
+    else e->writes++;
+    pthread_mutex_unlock(&e->stats_mutex);
+    
+    io_completion_add(c, 1);
+    stats_update(e, 1);
+    
+    int ret = submit_request(e, req);
+    if (ret < 0) {
+        stats_update(e, -1);
+        io_completion_finish(c, 0);
+        free(req);
+    }
+    return ret;
+}
+
+// Runs on the engine thread: opens the file and queues its reads
+static void start_prefetch(IoEngine *e, IoPrefetch *p) {
+    struct stat st;
+    
+    p->fd = open(p->path, O_RDONLY | O_CLOEXEC);
+    if (p->fd < 0) {
+        io_completion_finish(&p->done, -errno);
+        return;
+    }
+    if (fstat(p->fd, &st) != 0) {
+        io_completion_finish(&p->done, -errno);
+        return;
+    }
+    p->file_size = st.st_size;
+    
+    size_t want = p->file_size < p->max_bytes ? p->file_size : p->max_bytes;
+    pthread_mutex_lock(&e->queue_mutex);
+    size_t avail = e->prefetch_budget - e->prefetch_used;
+    if (want > avail) want = avail;
+    e->prefetch_used += want;
+    pthread_mutex_unlock(&e->queue_mutex);
+    
+    if (want > 0) {
+        p->data = malloc(want);
+        if (!p->data) {
+            pthread_mutex_lock(&e->queue_mutex);
+            e->prefetch_used -= want;
+            pthread_mutex_unlock(&e->queue_mutex);
+            want = 0;
+        }
+    }
+    p->loaded = p->reserved = want;
+    
+    for (size_t off = 0; off < want; off += IO_READ_CHUNK) {
+        size_t len = want - off < IO_READ_CHUNK ? want - off : IO_READ_CHUNK;
+        if (submit_transfer(e, IO_REQ_READ, &p->done, p->fd, p->data + off, len, off, NULL) < 0) {
+            // Whatever was not queued is read through the fd later
+            p->loaded = off;
+            break;
+        }
+    }
+    
+    // Drop the reference that covered the open
+    io_completion_finish(&p->done, 0);
+}
+
+static void start_queued_prefetches(IoEngine *e) {
+    pthread_mutex_lock(&e->queue_mutex);
+    IoPrefetch *p = e->queue_head;
+    e->queue_head = e->queue_tail = NULL;
+    pthread_mutex_unlock(&e->queue_mutex);
+    
+    while (p) {
+        IoPrefetch *next = p->next;
+        start_prefetch(e, p);
+        p = next;
+    }
+}
+
+static void *engine_thread(void *arg) {
+    IoEngine *e = arg;
+    
+    while (1) {
+        start_queued_prefetches(e);
+        
+        pthread_mutex_lock(&e->stats_mutex);
+        int idle = e->inflight == 0;
+        pthread_mutex_unlock(&e->stats_mutex);
+        pthread_mutex_lock(&e->queue_mutex);
+        idle = idle && !e->queue_head;
+        pthread_mutex_unlock(&e->queue_mutex);
+        if (idle && atomic_load(&e->stop)) break;
+        
+        struct io_uring_cqe *cqe;
+        if (io_uring_wait_cqe(&e->ring, &cqe) < 0) continue;
+        
+        do {
+            IoRequest *req = io_uring_cqe_get_data(cqe);
+            int res = cqe->res;
+            io_uring_cqe_seen(&e->ring, cqe);
+            handle_completion(e, req, res);
+        } while (io_uring_peek_cqe(&e->ring, &cqe) == 0);
+    }
+    return NULL;
+}
+
+IoEngine *io_engine_create(unsigned queue_depth, size_t prefetch_budget) {
+    IoEngine *e = calloc(1, sizeof(*e));
+    if (!e) return NULL;
+    
+    if (io_uring_queue_init(queue_depth, &e->ring, 0) < 0) {
+        free(e);
+        return NULL;
+    }
+    
+    pthread_mutex_init(&e->sq_mutex, NULL);
+    pthread_mutex_init(&e->queue_mutex, NULL);
+    pthread_mutex_init(&e->stats_mutex, NULL);
+    e->prefetch_budget = prefetch_budget;
+    e->start_time = e->last_change = now_sec();
+    
+    if (pthread_create(&e->thread, NULL, engine_thread, e) != 0) {
+        io_uring_queue_exit(&e->ring);
+        free(e);
+        return NULL;
+    }
+    return e;
+}
+
+void io_engine_destroy(IoEngine *e) {
+    if (!e) return;
+    
+    atomic_store(&e->stop, 1);
+    wake_engine(e);
+    pthread_join(e->thread, NULL);
+    
+    io_uring_queue_exit(&e->ring);
+    pthread_mutex_destroy(&e->stats_mutex);
+    pthread_mutex_destroy(&e->queue_mutex);
+    pthread_mutex_destroy(&e->sq_mutex);
+    free(e);
+}
+
+IoPrefetch *io_engine_prefetch(IoEngine *e, const char *path, size_t max_bytes) {
+    IoPrefetch *p = calloc(1, sizeof(*p));
+    if (!p) return NULL;
+    
+    p->path = strdup(path);
+    if (!p->path) {
+        free(p);
+        return NULL;
+    }
+    p->fd = -1;
+    p->max_bytes = max_bytes;
+    io_completion_init(&p->done);
+    p->done.pending = 1;
+    
+    pthread_mutex_lock(&e->queue_mutex);
+    if (e->queue_tail) e->queue_tail->next = p;
+    else e->queue_head = p;
+    e->queue_tail = p;
+    pthread_mutex_unlock(&e->queue_mutex);
+    
+    wake_engine(e);
+    return p;
+}
+
+int io_prefetch_wait(IoPrefetch *p) {
+    return io_completion_wait(&p->done, 0);
+}
+
+void io_prefetch_release(IoEngine *e, IoPrefetch *p) {
+    io_completion_wait(&p->done, 0);
+    
+    pthread_mutex_lock(&e->queue_mutex);
+    e->prefetch_used -= p->reserved;
+    pthread_mutex_unlock(&e->queue_mutex);
+    
+    if (p->fd >= 0) close(p->fd);
+    free(p->data);
+    free(p->path);
+    io_completion_destroy(&p->done);
+    free(p);
+}
+
+int io_engine_write(IoEngine *e, IoCompletion *c, int fd, void *buf, size_t len, uint64_t offset) {
+    int ret = submit_transfer(e, IO_REQ_WRITE, c, fd, buf, len, offset, buf);
+    if (ret == 0) return 0;
+    
+    // Queue unavailable: fall back to a blocking write
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            ret = n < 0 ? -errno : -EIO;
+            free(buf);
+            return ret;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    free(buf);
+    return 0;
+}
+
+void io_engine_report(IoEngine *e) {
+    if (!e) return;
+    
+    stats_update(e, 0);
+    pthread_mutex_lock(&e->stats_mutex);
+    double wall = e->last_change - e->start_time;
+    printf("I/O queue: busy %.1f%% of %.2fs, avg depth %.2f (max %d), "
+           "%llu reads (%.1f MB), %llu writes (%.1f MB)\n",
+           wall > 0 ? 100.0 * e->busy_time / wall : 0.0, wall,
+           wall > 0 ? e->depth_area / wall : 0.0, e->max_inflight,
+           (unsigned long long)e->reads, e->bytes_read / 1e6,
+           (unsigned long long)e->writes, e->bytes_written / 1e6);
+    pthread_mutex_unlock(&e->stats_mutex);
+}
+
+#else
+
+IoEngine *io_engine_create(unsigned queue_depth, size_t prefetch_budget) {
+    (void)queue_depth;
+    (void)prefetch_budget;
+    return NULL;
+}
+
+void io_engine_destroy(IoEngine *engine) {
+    (void)engine;
+}
+
+IoPrefetch *io_engine_prefetch(IoEngine *engine, const char *path, size_t max_bytes) {
+    (void)engine;
+    (void)path;
+    (void)max_bytes;
+    return NULL;
+}
+
+int io_prefetch_wait(IoPrefetch *p) {
+    (void)p;
+    return -ENOSYS;
+}
+
+void io_prefetch_release(IoEngine *engine, IoPrefetch *p) {
+    (void)engine;
+    (void)p;
+}
+
+int io_engine_write(IoEngine *engine, IoCompletion *c, int fd, void *buf, size_t len, uint64_t offset) {
+    (void)engine;
+    (void)c;
+    (void)fd;
+    (void)buf;
+    (void)len;
+    (void)offset;
+    return -ENOSYS;
+}
+
+void io_engine_report(IoEngine *engine) {
+    (void)engine;
+}
+
+#endif
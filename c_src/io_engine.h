@@ -0,0 +1,66 @@
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Asynchronous file I/O on top of io_uring (Linux, liburing). A single
+// engine thread owns the completion queue; worker threads submit reads of
+// upcoming inputs and writes of finished output buffers, so they only wait
+// when the disk falls behind the decoders.
+//
+// Build with `make URING=1` to enable. Without HAVE_LIBURING every entry
+// point is a stub and io_engine_create() returns NULL.
+
+typedef struct IoEngine IoEngine;
+
+// Counts the outstanding requests of one owner (a prefetch or a writer)
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int pending;
+    int error;
+} IoCompletion;
+
+// Input file being read ahead of the worker that will decode it. The first
+// `loaded` bytes are in `data`; anything past that is read through `fd`.
+typedef struct IoPrefetch {
+    char *path;
+    size_t max_bytes;
+    int fd;
+    uint8_t *data;
+    size_t loaded;
+    size_t reserved;    // share of the prefetch budget held by data
+    size_t file_size;
+    IoCompletion done;
+    struct IoPrefetch *next;
+} IoPrefetch;
+
+void io_completion_init(IoCompletion *c);
+void io_completion_destroy(IoCompletion *c);
+
+// Blocks until at most max_pending requests are outstanding. Returns the
+// first error reported by a completed request, or 0.
+int io_completion_wait(IoCompletion *c, int max_pending);
+
+IoEngine *io_engine_create(unsigned queue_depth, size_t prefetch_budget);
+void io_engine_destroy(IoEngine *engine);
+
+// Starts reading up to max_bytes of path in the background
+IoPrefetch *io_engine_prefetch(IoEngine *engine, const char *path, size_t max_bytes);
+
+// Waits for a prefetch to finish. Returns 0 or a negative errno.
+int io_prefetch_wait(IoPrefetch *p);
+
+// Closes the file and returns the buffer to the prefetch budget
+void io_prefetch_release(IoEngine *engine, IoPrefetch *p);
+
+// Queues a write of len bytes at offset. The engine takes ownership of buf
+// and frees it once the write has completed.
+int io_engine_write(IoEngine *engine, IoCompletion *c, int fd, void *buf, size_t len, uint64_t offset);
+
+// Prints queue utilisation and transfer totals for the run
+void io_engine_report(IoEngine *engine);
+
+#endif
@@ -0,0 +1,285 @@
+#include "sample_format.h"
+#include "cpu_dispatch.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define S16_SCALE 32768.0f
+#define S16_MAX 32767.0f
+#define S24_SCALE 8388608.0f
+#define S24_MAX 8388607.0f
+#define DITHER_SCALE (1.0f / 16777216.0f)
+#define ULAW_BIAS 0x84
+#define ULAW_CLIP 32635
+
+typedef void (*S16Kernel)(const float *in, int16_t *out, size_t n, DitherState *d);
+
+void dither_init(DitherState *d, uint32_t seed) {
+    // Spread the seed over the lanes; xorshift32 must never start at 0
+    for (int i = 0; i < DITHER_LANES; i++) {
+        uint32_t x = (seed + 0x9e3779b9u * (i + 1)) * 0x85ebca6bu;
+        x ^= x >> 16;
+        d->state[i] = x ? x : 0x6d2b79f5u;
+    }
+}
+
+static inline uint32_t xorshift32(uint32_t x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// Sum of two uniform [0, 1) values minus 1: triangular on (-1, 1) LSB. Every
+// kernel evaluates it in this order so all of them round identically.
+static inline float dither_next(uint32_t *state) {
+    uint32_t a = xorshift32(*state);
+    uint32_t b = xorshift32(a);
+    *state = b;
+    float u1 = (float)(a >> 8) * DITHER_SCALE;
+    float u2 = (float)(b >> 8) * DITHER_SCALE;
+    return (u1 + u2) - 1.0f;
+}
+
+static inline float clampf(float x, float lo, float hi) {
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+// Sample i always takes its dither from lane i % DITHER_LANES, the layout
+// the vector kernels use, so they can hand their tail to this one
+static void s16_scalar_from(const float *in, int16_t *out, size_t start, size_t n, DitherState *d) {
+    for (size_t i = start; i < n; i++) {
+        float y = in[i] * S16_SCALE + dither_next(&d->state[i % DITHER_LANES]);
+        out[i] = (int16_t)lrintf(clampf(y, -S16_SCALE, S16_MAX));
+    }
+}
+
+static void s16_scalar(const float *in, int16_t *out, size_t n, DitherState *d) {
+    s16_scalar_from(in, out, 0, n, d);
+}
+
+#if defined(__SSE2__) || defined(__x86_64__)
+static inline __m128i xorshift32_sse2(__m128i x) {
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+static inline __m128 dither_sse2(__m128i *state) {
+    __m128i a = xorshift32_sse2(*state);
+    __m128i b = xorshift32_sse2(a);
+    *state = b;
+    __m128 scale = _mm_set1_ps(DITHER_SCALE);
+    __m128 u1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(a, 8)), scale);
+    __m128 u2 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(b, 8)), scale);
+    return _mm_sub_ps(_mm_add_ps(u1, u2), _mm_set1_ps(1.0f));
+}
+
+static inline __m128i s16_round_sse2(__m128 x, __m128i *state) {
+    __m128 y = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(S16_SCALE)), dither_sse2(state));
+    y = _mm_min_ps(_mm_max_ps(y, _mm_set1_ps(-S16_SCALE)), _mm_set1_ps(S16_MAX));
+    return _mm_cvtps_epi32(y);
+}
+
+static void s16_sse2(const float *in, int16_t *out, size_t n, DitherState *d) {
+    __m128i s0 = _mm_loadu_si128((const __m128i *)d->state);
+    __m128i s1 = _mm_loadu_si128((const __m128i *)(d->state + 4));
+    size_t i = 0;
+    for (; i + DITHER_LANES <= n; i += DITHER_LANES) {
+        __m128i lo = s16_round_sse2(_mm_loadu_ps(in + i), &s0);
+        __m128i hi = s16_round_sse2(_mm_loadu_ps(in + i + 4), &s1);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(lo, hi));
+    }
+    _mm_storeu_si128((__m128i *)d->state, s0);
+    _mm_storeu_si128((__m128i *)(d->state + 4), s1);
+    s16_scalar_from(in, out, i, n, d);
+}
+#define HAVE_S16_SSE2 1
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("avx2")))
+static void s16_avx2(const float *in, int16_t *out, size_t n, DitherState *d) {
+    __m256i state = _mm256_loadu_si256((const __m256i *)d->state);
+    __m256 scale = _mm256_set1_ps(S16_SCALE);
+    __m256 dither_scale = _mm256_set1_ps(DITHER_SCALE);
+    size_t i = 0;
+    for (; i + DITHER_LANES <= n; i += DITHER_LANES) {
+        __m256i a = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+        a = _mm256_xor_si256(a, _mm256_srli_epi32(a, 17));
+        a = _mm256_xor_si256(a, _mm256_slli_epi32(a, 5));
+        __m256i b = _mm256_xor_si256(a, _mm256_slli_epi32(a, 13));
+        b = _mm256_xor_si256(b, _mm256_srli_epi32(b, 17));
+        b = _mm256_xor_si256(b, _mm256_slli_epi32(b, 5));
+        state = b;
+        
+        __m256 u1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(a, 8)), dither_scale);
+        __m256 u2 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(b, 8)), dither_scale);
+        __m256 t = _mm256_sub_ps(_mm256_add_ps(u1, u2), _mm256_set1_ps(1.0f));
+        
+        __m256 y = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), t);
+        y = _mm256_min_ps(_mm256_max_ps(y, _mm256_set1_ps(-S16_SCALE)), _mm256_set1_ps(S16_MAX));
+        __m256i v = _mm256_cvtps_epi32(y);
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        _mm_storeu_si128((__m128i *)(out + i), packed);
+    }
+    _mm256_storeu_si256((__m256i *)d->state, state);
+    s16_scalar_from(in, out, i, n, d);
+}
+#define HAVE_S16_AVX2 1
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static inline uint32x4_t xorshift32_neon(uint32x4_t x) {
+    x = veorq_u32(x, vshlq_n_u32(x, 13));
+    x = veorq_u32(x, vshrq_n_u32(x, 17));
+    return veorq_u32(x, vshlq_n_u32(x, 5));
+}
+
+static inline int32x4_t s16_round_neon(float32x4_t x, uint32x4_t *state) {
+    uint32x4_t a = xorshift32_neon(*state);
+    uint32x4_t b = xorshift32_neon(a);
+    *state = b;
+    float32x4_t scale = vdupq_n_f32(DITHER_SCALE);
+    float32x4_t u1 = vmulq_f32(vcvtq_f32_u32(vshrq_n_u32(a, 8)), scale);
+    float32x4_t u2 = vmulq_f32(vcvtq_f32_u32(vshrq_n_u32(b, 8)), scale);
+    float32x4_t t = vsubq_f32(vaddq_f32(u1, u2), vdupq_n_f32(1.0f));
+    
+    float32x4_t y = vaddq_f32(vmulq_f32(x, vdupq_n_f32(S16_SCALE)), t);
+    y = vminq_f32(vmaxq_f32(y, vdupq_n_f32(-S16_SCALE)), vdupq_n_f32(S16_MAX));
+    return vcvtnq_s32_f32(y);
+}
+
+static void s16_neon(const float *in, int16_t *out, size_t n, DitherState *d) {
+    uint32x4_t s0 = vld1q_u32(d->state);
+    uint32x4_t s1 = vld1q_u32(d->state + 4);
+    size_t i = 0;
+    for (; i + DITHER_LANES <= n; i += DITHER_LANES) {
+        int32x4_t lo = s16_round_neon(vld1q_f32(in + i), &s0);
+        int32x4_t hi = s16_round_neon(vld1q_f32(in + i + 4), &s1);
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+    vst1q_u32(d->state, s0);
+    vst1q_u32(d->state + 4, s1);
+    s16_scalar_from(in, out, i, n, d);
+}
+#define HAVE_S16_NEON 1
+#endif
+
+static const CpuKernel s16_kernels[] = {
+#if defined(HAVE_S16_AVX2)
+    {(CpuKernelFn)s16_avx2, "avx2", CPU_AVX2},
+#endif
+#if defined(HAVE_S16_SSE2)
+    {(CpuKernelFn)s16_sse2, "sse2", 0},
+#elif defined(HAVE_S16_NEON)
+    {(CpuKernelFn)s16_neon, "neon", 0},
+#endif
+    {(CpuKernelFn)s16_scalar, "scalar", 0}
+};
+
+static CpuDispatch s16_dispatch = { .options = s16_kernels };
+
+const char *sample_convert_kernel_name(void) {
+    return cpu_dispatch(&s16_dispatch)->name;
+}
+
+// s24 and mu-law are written without branches in the loop body so the
+// compiler can vectorize them; neither carries dither
+static void s24_convert(const float *in, uint8_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = (int32_t)lrintf(clampf(in[i] * S24_SCALE, -S24_SCALE, S24_MAX));
+        out[3 * i] = v & 0xff;
+        out[3 * i + 1] = (v >> 8) & 0xff;
+        out[3 * i + 2] = (v >> 16) & 0xff;
+    }
+}
+
+void sample_convert_s24_msb(const float *in, int32_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (int32_t)lrintf(clampf(in[i] * S24_SCALE, -S24_SCALE, S24_MAX)) * 256;
+    }
+}
+
+// G.711 mu-law encoding of a 16-bit sample
+static inline uint8_t ulaw_encode(int pcm) {
+    int sign = pcm < 0 ? 0x80 : 0;
+    int mag = pcm < 0 ? -pcm : pcm;
+    if (mag > ULAW_CLIP) mag = ULAW_CLIP;
+    mag += ULAW_BIAS;
+    
+    // mag is at least ULAW_BIAS, so its top bit is one of bits 7 to 14
+    int exponent = 31 - __builtin_clz(mag) - 7;
+    int mantissa = (mag >> (exponent + 3)) & 0x0f;
+    return ~(sign | (exponent << 4) | mantissa);
+}
+
+static void ulaw_convert(const float *in, uint8_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = ulaw_encode((int)lrintf(clampf(in[i] * S16_SCALE, -S16_SCALE, S16_MAX)));
+    }
+}
+
+void sample_convert(SampleFormat format, const float *in, uint8_t *out, size_t n, DitherState *d) {
+    switch (format) {
+    case SAMPLE_FORMAT_F32:
+        memcpy(out, in, n * sizeof(float));
+        break;
+    case SAMPLE_FORMAT_S16:
+        ((S16Kernel)cpu_dispatch(&s16_dispatch)->kernel)(in, (int16_t *)out, n, d);
+        break;
+    case SAMPLE_FORMAT_S24:
+        s24_convert(in, out, n);
+        break;
+    case SAMPLE_FORMAT_ULAW:
+        ulaw_convert(in, out, n);
+        break;
+    }
+}
+
+static const struct {
+    const char *name;
+    int bytes;
+    int wav_tag;
+} sample_formats[] = {
+    [SAMPLE_FORMAT_F32] = {"f32", 4, 3},
+    [SAMPLE_FORMAT_S16] = {"s16", 2, 1},
+    [SAMPLE_FORMAT_S24] = {"s24", 3, 0xFFFE},
+    [SAMPLE_FORMAT_ULAW] = {"ulaw", 1, 7}
+};
+
+int sample_format_parse(const char *name, SampleFormat *format) {
+    for (int i = 0; i < (int)(sizeof(sample_formats) / sizeof(sample_formats[0])); i++) {
+        if (strcmp(name, sample_formats[i].name) == 0) {
+            *format = (SampleFormat)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *sample_format_name(SampleFormat format) {
+    return sample_formats[format].name;
+}
+
+int sample_format_bytes(SampleFormat format) {
+    return sample_formats[format].bytes;
+}
+
+int sample_format_wav_tag(SampleFormat format) {
+    return sample_formats[format].wav_tag;
+}
+
+int sample_format_bits(SampleFormat format) {
+    return sample_formats[format].bytes * 8;
+}
+
+uint8_t sample_format_silence(SampleFormat format) {
+    return format == SAMPLE_FORMAT_ULAW ? 0xff : 0;
+}
@@ -0,0 +1,53 @@
+#ifndef SAMPLE_FORMAT_H
+#define SAMPLE_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Output sample formats. Processing always runs on float32; the writer
+// converts each block as it is staged, so the narrower formats cost no
+// extra pass over the audio.
+typedef enum {
+    SAMPLE_FORMAT_F32,
+    SAMPLE_FORMAT_S16,      // TPDF dithered
+    SAMPLE_FORMAT_S24,
+    SAMPLE_FORMAT_ULAW      // G.711 mu-law, 8 bits
+} SampleFormat;
+
+// Triangular dither for s16. Eight independent xorshift32 generators, one
+// per lane, so the SIMD kernels and the scalar fallback produce the same
+// bytes for the same seed.
+#define DITHER_LANES 8
+
+typedef struct {
+    uint32_t state[DITHER_LANES];
+} DitherState;
+
+void dither_init(DitherState *d, uint32_t seed);
+
+// Returns 0 and sets *format for "f32", "s16", "s24" or "ulaw", -1 otherwise
+int sample_format_parse(const char *name, SampleFormat *format);
+const char *sample_format_name(SampleFormat format);
+
+// Bytes per sample, the WAVE format tag and bits per sample. s24 is tagged
+// WAVE_FORMAT_EXTENSIBLE (0xFFFE) with the PCM sub-format, as RIFF requires
+// for PCM above 16 bits.
+int sample_format_bytes(SampleFormat format);
+int sample_format_wav_tag(SampleFormat format);
+int sample_format_bits(SampleFormat format);
+
+// Byte value of digital silence (0, or 0xff for mu-law)
+uint8_t sample_format_silence(SampleFormat format);
+
+// Converts n float samples in [-1, 1] to format, clipping out-of-range
+// values. The dither state is only used by s16.
+void sample_convert(SampleFormat format, const float *in, uint8_t *out, size_t n, DitherState *d);
+
+// Converts to 24-bit samples held in the top bits of int32, the layout
+// FFmpeg's s32 encoders expect when bits_per_raw_sample is 24
+void sample_convert_s24_msb(const float *in, int32_t *out, size_t n);
+
+// Name of the s16 kernel selected for this CPU
+const char *sample_convert_kernel_name(void);
+
+#endif
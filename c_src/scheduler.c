@@ -0,0 +1,360 @@
+#include "scheduler.h"
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+#define WORK_DEQUE_INITIAL_SIZE 256
+#define WORK_SPIN_ROUNDS 64
+#define WORK_YIELD_ROUNDS 128
+#define WORK_SLEEP_NS 100000
+
+// Returned by work_deque_steal() when it lost a race and should retry
+#define WORK_ABORT ((void *)&work_abort_marker)
+static const char work_abort_marker;
+
+// The deque follows Lê et al., "Correct and Efficient Work-Stealing for Weak
+// Memory Models" (PPoPP 2013): the owner works at the bottom without atomic
+// read-modify-write unless a single item is left, thieves CAS the top.
+
+static WorkArray *work_array_create(long size) {
+    WorkArray *a = calloc(1, sizeof(WorkArray));
+    if (!a) return NULL;
+    a->items = calloc(size, sizeof(*a->items));
+    if (!a->items) {
+        free(a);
+        return NULL;
+    }
+    a->size = size;
+    return a;
+}
+
+static void *work_array_get(WorkArray *a, long i) {
+    return atomic_load_explicit(&a->items[i & (a->size - 1)], memory_order_relaxed);
+}
+
+static void work_array_put(WorkArray *a, long i, void *item) {
+    atomic_store_explicit(&a->items[i & (a->size - 1)], item, memory_order_relaxed);
+}
+
+// Old arrays stay reachable through `retired` until the deque is destroyed,
+// because a thief may still be reading from one
+static WorkArray *work_array_grow(WorkDeque *d, WorkArray *a, long top, long bottom) {
+    WorkArray *bigger = work_array_create(a->size * 2);
+    if (!bigger) return NULL;
+    for (long i = top; i < bottom; i++) work_array_put(bigger, i, work_array_get(a, i));
+    bigger->retired = a;
+    atomic_store_explicit(&d->array, bigger, memory_order_release);
+    return bigger;
+}
+
+static int work_deque_init(WorkDeque *d) {
+    WorkArray *a = work_array_create(WORK_DEQUE_INITIAL_SIZE);
+    if (!a) return -1;
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    atomic_init(&d->array, a);
+    return 0;
+}
+
+static void work_deque_free(WorkDeque *d) {
+    WorkArray *a = atomic_load(&d->array);
+    while (a) {
+        WorkArray *next = a->retired;
+        free(a->items);
+        free(a);
+        a = next;
+    }
+    atomic_store(&d->array, NULL);
+}
+
+static int work_deque_push(WorkDeque *d, void *item) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    WorkArray *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+    
+    if (b - t > a->size - 1) {
+        a = work_array_grow(d, a, t, b);
+        if (!a) return -1;
+    }
+    work_array_put(a, b, item);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+static void *work_deque_take(WorkDeque *d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    WorkArray *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    
+    void *item = work_array_get(a, b);
+    if (t == b) {
+        // Last item: race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed)) {
+            item = NULL;
+        }
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+static void *work_deque_steal(WorkDeque *d) {
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) return NULL;
+    
+    WorkArray *a = atomic_load_explicit(&d->array, memory_order_acquire);
+    void *item = work_array_get(a, t);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return WORK_ABORT;
+    }
+    return item;
+}
+
+// Waiting strategy for a worker with nothing to do: spin briefly, then
+// yield, then sleep so long waits do not burn a core
+static void work_backoff(int round) {
+    if (round < WORK_SPIN_ROUNDS) {
+        cpu_relax();
+    } else if (round < WORK_YIELD_ROUNDS) {
+        sched_yield();
+    } else {
+        struct timespec ts = {0, WORK_SLEEP_NS};
+        nanosleep(&ts, NULL);
+    }
+}
+
+int work_scheduler_init(WorkScheduler *s, int num_workers) {
+    s->num_workers = num_workers;
+    s->deques = aligned_alloc(64, num_workers * sizeof(WorkDeque));
+    if (!s->deques) return -1;
+    atomic_init(&s->outstanding, 0);
+    atomic_init(&s->steals, 0);
+    
+    for (int i = 0; i < num_workers; i++) {
+        if (work_deque_init(&s->deques[i]) < 0) {
+            for (int j = 0; j < i; j++) work_deque_free(&s->deques[j]);
+            free(s->deques);
+            s->deques = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void work_scheduler_destroy(WorkScheduler *s) {
+    if (!s->deques) return;
+    for (int i = 0; i < s->num_workers; i++) work_deque_free(&s->deques[i]);
+    free(s->deques);
+    s->deques = NULL;
+}
+
+int work_scheduler_seed(WorkScheduler *s, void **items, long count, long chunk) {
+    if (chunk < 1) chunk = 1;
+    long chunks = (count + chunk - 1) / chunk;
+    
+    // Owners pop their newest item first, so push each deque's share back
+    // to front to keep the caller's order
+    for (long c = chunks - 1; c >= 0; c--) {
+        WorkDeque *d = &s->deques[c % s->num_workers];
+        long end = (c + 1) * chunk < count ? (c + 1) * chunk : count;
+        for (long i = end - 1; i >= c * chunk; i--) {
+            if (work_deque_push(d, items[i]) < 0) return -1;
+            atomic_fetch_add_explicit(&s->outstanding, 1, memory_order_relaxed);
+        }
+    }
+    return 0;
+}
+
+int work_scheduler_push(WorkScheduler *s, int worker, void *item) {
+    atomic_fetch_add_explicit(&s->outstanding, 1, memory_order_relaxed);
+    if (work_deque_push(&s->deques[worker], item) < 0) {
+        atomic_fetch_sub_explicit(&s->outstanding, 1, memory_order_relaxed);
+        return -1;
+    }
+    return 0;
+}
+
+static void *work_scheduler_steal(WorkScheduler *s, int worker) {
+    static _Thread_local uint32_t rng;
+    if (!rng) rng = 2654435761u * (uint32_t)(worker + 1);
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    
+    int n = s->num_workers;
+    int start = rng % n;
+    for (int i = 0; i < n; i++) {
+        int victim = (start + i) % n;
+        if (victim == worker) continue;
+        
+        void *item;
+        while ((item = work_deque_steal(&s->deques[victim])) == WORK_ABORT) cpu_relax();
+        if (item) {
+            atomic_fetch_add_explicit(&s->steals, 1, memory_order_relaxed);
+            return item;
+        }
+    }
+    return NULL;
+}
+
+void *work_scheduler_next(WorkScheduler *s, int worker) {
+    for (int round = 0;; round++) {
+        void *item = work_deque_take(&s->deques[worker]);
+        if (item) return item;
+        
+        item = work_scheduler_steal(s, worker);
+        if (item) return item;
+        
+        // Nothing queued anywhere; done unless a running item may still push
+        if (atomic_load_explicit(&s->outstanding, memory_order_acquire) == 0) return NULL;
+        
+        work_backoff(round);
+    }
+}
+
+void work_scheduler_done(WorkScheduler *s) {
+    atomic_fetch_sub_explicit(&s->outstanding, 1, memory_order_release);
+}
+
+void work_scheduler_hold(WorkScheduler *s) {
+    atomic_fetch_add_explicit(&s->outstanding, 1, memory_order_relaxed);
+}
+
+long work_scheduler_pending(WorkScheduler *s, int worker) {
+    WorkDeque *d = &s->deques[worker];
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    return b > t ? b - t : 0;
+}
+
+void *work_scheduler_peek(WorkScheduler *s, int worker, long depth) {
+    WorkDeque *d = &s->deques[worker];
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    long i = b - 1 - depth;
+    if (i < t) return NULL;
+    return work_array_get(atomic_load_explicit(&d->array, memory_order_relaxed), i);
+}
+
+int work_queue_init(WorkQueue *q, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) size *= 2;
+    
+    q->cells = malloc(size * sizeof(WorkQueueCell));
+    if (!q->cells) return -1;
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&q->cells[i].seq, i);
+        q->cells[i].item = NULL;
+    }
+    q->mask = size - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->closed, 0);
+    atomic_init(&q->depth_sum, 0);
+    atomic_init(&q->pushes, 0);
+    return 0;
+}
+
+void work_queue_destroy(WorkQueue *q) {
+    free(q->cells);
+    q->cells = NULL;
+}
+
+// A cell whose sequence equals the position is free for the producer at
+// that position; position + 1 means it holds an item for the consumer
+int work_queue_try_push(WorkQueue *q, void *item) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    
+    for (;;) {
+        WorkQueueCell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->item = item;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                
+                size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+                atomic_fetch_add_explicit(&q->depth_sum, pos + 1 - tail, memory_order_relaxed);
+                atomic_fetch_add_explicit(&q->pushes, 1, memory_order_relaxed);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+}
+
+void *work_queue_try_pop(WorkQueue *q) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    
+    for (;;) {
+        WorkQueueCell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                void *item = cell->item;
+                atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+                return item;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+}
+
+void work_queue_push(WorkQueue *q, void *item) {
+    for (int round = 0; !work_queue_try_push(q, item); round++) work_backoff(round);
+}
+
+void *work_queue_pop(WorkQueue *q) {
+    for (int round = 0;; round++) {
+        void *item = work_queue_try_pop(q);
+        if (item) return item;
+        
+        // Recheck after seeing the flag: a push may have landed just before it
+        if (atomic_load_explicit(&q->closed, memory_order_acquire)) return work_queue_try_pop(q);
+        work_backoff(round);
+    }
+}
+
+void work_queue_close(WorkQueue *q) {
+    atomic_store_explicit(&q->closed, 1, memory_order_release);
+}
+
+double work_queue_occupancy(WorkQueue *q) {
+    unsigned long pushes = atomic_load(&q->pushes);
+    if (pushes == 0) return 0.0;
+    return (double)atomic_load(&q->depth_sum) / pushes / (q->mask + 1);
+}
@@ -0,0 +1,104 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Lock-free work-stealing scheduler. Every worker owns a Chase-Lev deque:
+// it pushes and pops at the bottom, idle workers steal from the top of a
+// victim's deque. Only atomic operations are used on the hot path, so
+// workers can push fine-grained sub-tasks without a shared lock.
+
+typedef struct WorkArray {
+    long size;                      // power of two
+    _Atomic(void *) *items;
+    struct WorkArray *retired;      // previous, smaller arrays
+} WorkArray;
+
+typedef struct {
+    _Alignas(64) atomic_long top;
+    _Alignas(64) atomic_long bottom;
+    _Atomic(WorkArray *) array;
+} WorkDeque;
+
+typedef struct {
+    int num_workers;
+    WorkDeque *deques;
+    // Items pushed but not yet reported finished with work_scheduler_done()
+    _Alignas(64) atomic_long outstanding;
+    atomic_ulong steals;
+} WorkScheduler;
+
+int work_scheduler_init(WorkScheduler *s, int num_workers);
+void work_scheduler_destroy(WorkScheduler *s);
+
+// Deals items across the workers' deques in chunks of `chunk` consecutive
+// items before any worker runs. Each worker pops its items in the given
+// order. Must not be called once workers have started.
+int work_scheduler_seed(WorkScheduler *s, void **items, long count, long chunk);
+
+// Pushes an item onto the calling worker's own deque. Items must not be NULL.
+int work_scheduler_push(WorkScheduler *s, int worker, void *item);
+
+// Returns the next item for the worker: its own newest item, else one
+// stolen from another worker. Blocks (spinning, then sleeping) while other
+// workers still hold items that might spawn more work. Returns NULL once
+// every item has been finished.
+void *work_scheduler_next(WorkScheduler *s, int worker);
+
+// Marks an item returned by work_scheduler_next() as finished
+void work_scheduler_done(WorkScheduler *s);
+
+// Keeps work_scheduler_next() from returning NULL until the matching
+// work_scheduler_done(). Lets a producer that owns a deque but runs no items
+// feed the workers after they have started.
+void work_scheduler_hold(WorkScheduler *s);
+
+// Number of items queued in a deque. Racy, meant for bounding a producer.
+long work_scheduler_pending(WorkScheduler *s, int worker);
+
+// Returns the item `depth` positions below the next one in the worker's own
+// deque without removing it, or NULL. Owner only; the item may still be
+// stolen concurrently.
+void *work_scheduler_peek(WorkScheduler *s, int worker, long depth);
+
+// Bounded multi-producer multi-consumer FIFO of pointers (Vyukov's ring of
+// sequenced cells), used to hand batches between pipeline stages. Blocking
+// calls spin, yield and then sleep; nothing takes a lock.
+typedef struct {
+    atomic_size_t seq;
+    void *item;
+} WorkQueueCell;
+
+typedef struct {
+    WorkQueueCell *cells;
+    size_t mask;
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    _Alignas(64) atomic_int closed;
+    // Queue length sampled at every push, for occupancy reports
+    atomic_ulong depth_sum;
+    atomic_ulong pushes;
+} WorkQueue;
+
+// Capacity is rounded up to a power of two
+int work_queue_init(WorkQueue *q, size_t capacity);
+void work_queue_destroy(WorkQueue *q);
+
+// Non-blocking variants return 0 when the queue is full or empty
+int work_queue_try_push(WorkQueue *q, void *item);
+void *work_queue_try_pop(WorkQueue *q);
+
+// Waits for space. Items must not be NULL.
+void work_queue_push(WorkQueue *q, void *item);
+
+// Waits for an item. Returns NULL once the queue is closed and drained.
+void *work_queue_pop(WorkQueue *q);
+
+// No more pushes will follow; wakes consumers to drain and exit
+void work_queue_close(WorkQueue *q);
+
+// Average fill level seen by producers, 0 to 1
+double work_queue_occupancy(WorkQueue *q);
+
+#endif
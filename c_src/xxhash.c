@@ -0,0 +1,131 @@
+#include "xxhash.h"
+
+#include <string.h>
+
+#define XXH_PRIME1 0x9E3779B185EBCA87ull
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4Full
+#define XXH_PRIME3 0x165667B19E3779F9ull
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ull
+#define XXH_PRIME5 0x27D4EB2F165667C5ull
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads without alignment requirements
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+// Consumes whole 32-byte stripes and returns the bytes used
+static size_t xxh_stripes(uint64_t v[4], const uint8_t *p, size_t len) {
+    size_t done = 0;
+    for (; done + 32 <= len; done += 32) {
+        v[0] = xxh_round(v[0], read64(p + done));
+        v[1] = xxh_round(v[1], read64(p + done + 8));
+        v[2] = xxh_round(v[2], read64(p + done + 16));
+        v[3] = xxh_round(v[3], read64(p + done + 24));
+    }
+    return done;
+}
+
+void xxh64_init(Xxh64State *s, uint64_t seed) {
+    memset(s, 0, sizeof(*s));
+    s->seed = seed;
+    s->v[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+    s->v[1] = seed + XXH_PRIME2;
+    s->v[2] = seed;
+    s->v[3] = seed - XXH_PRIME1;
+}
+
+void xxh64_update(Xxh64State *s, const void *data, size_t len) {
+    const uint8_t *p = data;
+    s->total_len += len;
+    
+    if (s->mem_len + len < 32) {
+        memcpy(s->mem + s->mem_len, p, len);
+        s->mem_len += len;
+        return;
+    }
+    
+    if (s->mem_len) {
+        size_t fill = 32 - s->mem_len;
+        memcpy(s->mem + s->mem_len, p, fill);
+        xxh_stripes(s->v, s->mem, 32);
+        p += fill;
+        len -= fill;
+        s->mem_len = 0;
+    }
+    
+    size_t used = xxh_stripes(s->v, p, len);
+    memcpy(s->mem, p + used, len - used);
+    s->mem_len = len - used;
+}
+
+uint64_t xxh64_digest(const Xxh64State *s) {
+    uint64_t h;
+    
+    if (s->total_len >= 32) {
+        h = rotl64(s->v[0], 1) + rotl64(s->v[1], 7) + rotl64(s->v[2], 12) + rotl64(s->v[3], 18);
+        for (int i = 0; i < 4; i++) h = xxh_merge(h, s->v[i]);
+    } else {
+        h = s->seed + XXH_PRIME5;
+    }
+    h += s->total_len;
+    
+    const uint8_t *p = s->mem;
+    size_t len = s->mem_len;
+    for (; len >= 8; p += 8, len -= 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)read32(p) * XXH_PRIME1;
+        h = rotl64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; p++, len--) {
+        h ^= *p * XXH_PRIME5;
+        h = rotl64(h, 11) * XXH_PRIME1;
+    }
+    
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+    Xxh64State s;
+    xxh64_init(&s, seed);
+    xxh64_update(&s, data, len);
+    return xxh64_digest(&s);
+}
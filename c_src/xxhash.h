@@ -0,0 +1,26 @@
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming XXH64 (Yann Collet's xxHash, 64-bit variant). Runs at memory
+// bandwidth on one core, so hashing an input costs far less than decoding
+// it. Digests match the reference implementation.
+typedef struct {
+    uint64_t total_len;
+    uint64_t v[4];
+    uint8_t mem[32];    // input not yet consumed as a full stripe
+    size_t mem_len;
+    uint64_t seed;
+} Xxh64State;
+
+void xxh64_init(Xxh64State *s, uint64_t seed);
+void xxh64_update(Xxh64State *s, const void *data, size_t len);
+
+// Does not modify the state, so more data may follow
+uint64_t xxh64_digest(const Xxh64State *s);
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+#endif